@@ -0,0 +1,118 @@
+#include "irc-casemap.h++"
+#include "irc-client.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace cq_irc {
+
+namespace {
+
+	char upper_bound(int casemapping)
+	{
+		switch (casemapping) {
+		case CQ_IRC_CASEMAPPING_ASCII: return 'Z';
+		case CQ_IRC_CASEMAPPING_STRICT_RFC1459: return ']';
+		default: return '^';
+		}
+	}
+
+	inline char fold_char(char c, char high)
+	{
+		return (c >= 'A' && c <= high) ? c + 0x20 : c;
+	}
+
+#ifdef __SSE2__
+	/* Bytes >= 0x80 compare as negative and so are never folded. */
+	inline __m128i fold_block(__m128i chunk, __m128i low, __m128i high, __m128i bit)
+	{
+		__m128i in_range = _mm_and_si128(
+			_mm_cmpgt_epi8(chunk, low),
+			_mm_cmplt_epi8(chunk, high));
+
+		return _mm_add_epi8(chunk, _mm_and_si128(in_range, bit));
+	}
+#endif
+}
+
+void casefold(const char *in, std::size_t size, char *out, int casemapping)
+{
+	char high = upper_bound(casemapping);
+	std::size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i low_v = _mm_set1_epi8('A' - 1);
+	const __m128i high_v = _mm_set1_epi8(high + 1);
+	const __m128i bit = _mm_set1_epi8(0x20);
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), fold_block(chunk, low_v, high_v, bit));
+	}
+#endif
+
+	for (; i < size; ++i)
+		out[i] = fold_char(in[i], high);
+}
+
+int casecmp(const char *a, std::size_t a_size, const char *b, std::size_t b_size, int casemapping)
+{
+	char high = upper_bound(casemapping);
+	std::size_t size = a_size < b_size ? a_size : b_size;
+	std::size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i low_v = _mm_set1_epi8('A' - 1);
+	const __m128i high_v = _mm_set1_epi8(high + 1);
+	const __m128i bit = _mm_set1_epi8(0x20);
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = fold_block(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), low_v, high_v, bit);
+		__m128i y = fold_block(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)), low_v, high_v, bit);
+		int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+		if (equal != 0xFFFF) {
+			i += __builtin_ctz(~equal);
+			break;
+		}
+	}
+#endif
+
+	for (; i < size; ++i) {
+		unsigned char x = fold_char(a[i], high);
+		unsigned char y = fold_char(b[i], high);
+
+		if (x != y)
+			return x < y ? -1 : 1;
+	}
+
+	return a_size == b_size ? 0 : (a_size < b_size ? -1 : 1);
+}
+
+uint32_t casehash(const char *data, std::size_t size, int casemapping)
+{
+	char buffer[512];
+	uint32_t hash = 2166136261u;
+
+	/* Fold a buffer at a time, then continue the FNV-1a chain over it so
+	 * the result matches hash_bytes() of the fully folded string. */
+	while (size) {
+		std::size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+
+		casefold(data, chunk, buffer, casemapping);
+
+		for (std::size_t i = 0; i < chunk; ++i) {
+			hash ^= static_cast<unsigned char>(buffer[i]);
+			hash *= 16777619u;
+		}
+
+		data += chunk;
+		size -= chunk;
+	}
+
+	return hash;
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+/* Case folding under the three CASEMAPPING values servers advertise.
+ * Each one is "add 0x20 to bytes in a contiguous range":
+ *
+ *   ascii           A-Z        (0x41-0x5A)
+ *   strict-rfc1459  A-Z [ \ ]  (0x41-0x5D)
+ *   rfc1459         A-Z [ \ ] ^ (0x41-0x5E)
+ *
+ * which is the {special} class of irc-client.l minus the characters
+ * that have no other case. That makes folding a range compare and a
+ * masked add, done here 16 bytes at a time. Mappings are passed as
+ * enum cq_irc_casemapping values. */
+
+namespace cq_irc {
+
+void casefold(const char *in, std::size_t size, char *out, int casemapping);
+
+/* memcmp-style ordering of the folded strings. */
+int casecmp(const char *a, std::size_t a_size, const char *b, std::size_t b_size, int casemapping);
+
+/* Hash of the folded string, equal for names the server treats as equal. */
+uint32_t casehash(const char *data, std::size_t size, int casemapping);
+
+}
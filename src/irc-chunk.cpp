@@ -0,0 +1,35 @@
+#include "irc-chunk.h++"
+#include "irc-intern.h++"
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+namespace cq_irc {
+
+cq_irc_chunk *chunk_create(std::size_t capacity)
+{
+	void *memory = malloc(offsetof(cq_irc_chunk, data) + capacity + chunk_slack);
+
+	if (!memory)
+		throw std::bad_alloc();
+
+	cq_irc_chunk *chunk = static_cast<cq_irc_chunk*>(memory);
+
+	new (&chunk->refs) std::atomic<unsigned>(1);
+	new (&chunk->pins) std::atomic<cq_irc::pin_list*>(nullptr);
+	chunk->capacity = capacity;
+	chunk->size = 0;
+
+	return chunk;
+}
+
+void chunk_release(cq_irc_chunk *chunk)
+{
+	if (chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		pins_release(chunk->pins.load(std::memory_order_acquire));
+		free(chunk);
+	}
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace cq_irc { struct pin_list; }
+
+/* A block of received bytes. The reader reads straight into one, parse
+ * jobs lex its lines in place and messages point into it, so one
+ * reference count keeps every string of every message from that read
+ * alive, the interned ones included: parse jobs hang their references
+ * to those on pins. The last reference frees it. */
+struct cq_irc_chunk {
+	std::atomic<unsigned> refs;
+	std::atomic<cq_irc::pin_list*> pins;
+	std::size_t capacity; /* bytes the reader may fill */
+	std::size_t size;     /* bytes received so far */
+	char data[1];         /* capacity + chunk_slack bytes */
+};
+
+namespace cq_irc {
+
+/* Bytes past capacity the reader never fills, so the lexer can always
+ * write the CR LF NUL NUL it needs after a line, even the last one. */
+const std::size_t chunk_slack = 4;
+
+cq_irc_chunk *chunk_create(std::size_t capacity);
+
+inline void chunk_retain(cq_irc_chunk *chunk)
+{
+	chunk->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void chunk_release(cq_irc_chunk *chunk);
+
+}
@@ -2,32 +2,290 @@
 
 #include <boost/asio.hpp>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <cstdio>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include "irc-client.h"
+#include "irc-chunk.h++"
+#include "irc-events.h++"
+#include "irc-interest.h++"
+#include "irc-intern.h++"
+#include "irc-isupport.h++"
+#include "irc-output.h++"
+#include "irc-slots.h++"
+#include "irc-state.h++"
+#include "irc-workers.h++"
 
 using namespace boost::system;
 using namespace boost::asio;
 
 struct cq_irc_service {
+	~cq_irc_service()
+	{
+		resolve_work.reset();
+
+		if (resolve_thread.joinable())
+			resolve_thread.join();
+
+		delete workers.exchange(nullptr);
+
+		/* Handlers left queued by a stop, such as the socket close of a
+		 * session destroyed since, hold references; running them lets
+		 * the sessions' pending reads unwind too. */
+		service.restart();
+		service.poll();
+
+		if (poll_fd >= 0)
+			close(poll_fd);
+
+		if (wake_fd >= 0)
+			close(wake_fd);
+	}
+
+	/* Nicks, idents, hosts and channel names seen by any session.
+	 * Declared ahead of service so it outlives the handlers service
+	 * destroys unrun, which may hold the last reference to a session. */
+	cq_irc::shared_intern_pool strings;
+
 	io_service service;
+
+	/* Every session not yet destroyed, by handle. While there are any,
+	 * work keeps attach() running: one guard for all of them, taken by
+	 * the first and dropped by the last. */
+	std::mutex sessions_mutex;
+	cq_irc::slot_map<cq_irc_session*> sessions;
+	std::unique_ptr<io_service::work> work;
+
+	/* Host names are resolved one at a time on resolve_thread, started
+	 * by the first connect, which posts each result back to service. */
+	io_service resolve_service;
+	ip::tcp::resolver resolver { resolve_service };
+	std::unique_ptr<io_service::work> resolve_work;
+	std::thread resolve_thread;
+	std::once_flag resolve_started;
+
+	/* For hosts running an event loop of their own, created by the first
+	 * cq_irc_service_get_fd(): an epoll set holding wake_fd (an eventfd)
+	 * and the socket of every session connected since, which turns
+	 * readable whenever there may be handlers to run. Once external is
+	 * set, every handler the library posts also signals wake_fd. */
+	std::once_flag fd_created;
+	std::atomic<bool> external { false };
+	int poll_fd = -1;
+	int wake_fd = -1;
+
+	/* Callback tables handed to cq_irc_session_connect(), one copy per
+	 * distinct table, shared by every session that passed it. */
+	std::mutex callbacks_mutex;
+	std::vector<std::weak_ptr<const cq_irc_callbacks>> callback_tables;
+
+	/* Low-latency mode, set by cq_irc_service_set_low_latency() and
+	 * applied to sessions as they connect. spin_us is how long attach()
+	 * keeps polling after the last handler before it blocks. */
+	std::atomic<bool> low_latency { false };
+	std::atomic<unsigned> busy_poll_us { 0 };
+	std::atomic<unsigned> spin_us { 0 };
+
+	/* Event bus subscriptions by handle, and the index compiled from
+	 * them: replaced whole on every change and read with atomic_load(),
+	 * null while there are none. */
+	std::mutex events_mutex;
+	cq_irc::slot_map<std::shared_ptr<const cq_irc::subscription>> subscriptions;
+	std::shared_ptr<const cq_irc::event_index> events;
+
+	/* Set once by cq_irc_service_start_workers(), never cleared. */
+	std::atomic<cq_irc::worker_pool*> workers { nullptr };
+
+	/* Received bytes held by parse jobs of all sessions, and the limit
+	 * past which sessions stop reading (0 for none). Sessions waiting
+	 * for the total to drop are listed in paused. */
+	std::atomic<std::size_t> pending_bytes { 0 };
+	std::atomic<std::size_t> budget { 0 };
+	std::mutex budget_mutex;
+	std::vector<cq_irc_session*> paused;
 };
 
 struct cq_irc_session {
 	cq_irc_session(struct cq_irc_service *_service)
-		: socket(_service->service), resolver(_service->service), 
-		  work(_service->service), output_strand(_service->service),
-		  service(_service)
+		: socket(_service->service), service(_service)
 	{ }
 
+	~cq_irc_session()
+	{
+		if (input)
+			cq_irc::chunk_release(input);
+
+		for (cq_irc::output_node *node : output_flight)
+			cq_irc::output_free(node);
+
+		delete state.load();
+	}
+
 	ip::tcp::socket socket;
-	ip::tcp::resolver resolver;
-	io_service::work work;
-	streambuf input;
-	strand output_strand; /* Prevents concurrent write requests. */
 
-	struct cq_irc_callbacks callbacks;
+	/* Held by the user until cq_irc_session_destroy(), by the chain of
+	 * handlers that connects and reads, by every parse job and by the
+	 * output drain while it is scheduled, so handlers already queued
+	 * when the user destroys the session never see it freed. Once
+	 * destroyed is set they unwind without calling back. */
+	std::atomic<unsigned> refs { 1 };
+	std::atomic<bool> destroyed { false };
+	uint64_t handle = 0;
+
+	/* The chunk the reader fills, null while the session is idle: it is
+	 * created once the socket is readable and let go as soon as nothing
+	 * of it is left to read. Everything before input_start has been
+	 * handed off or dropped; the rest is a partial line waiting for its
+	 * line break. */
+	cq_irc_chunk *input = nullptr;
+	std::size_t input_start = 0;
+
+	/* Received bytes held by this session's parse jobs and the limit
+	 * past which reading pauses (0 for none). */
+	std::atomic<std::size_t> pending_bytes { 0 };
+	std::atomic<std::size_t> budget { 0 };
+
+	/* Longest line we buffer (0 for no limit) and what happens to one
+	 * that is longer. The reader alone uses the other two: discarding
+	 * while the rest of an overlong line is still arriving. */
+	std::atomic<std::size_t> max_line { 16384 };
+	std::atomic<int> overflow_policy { CQ_IRC_OVERFLOW_DROP };
+	bool discarding = false;
+	bool overflowed = false;
+
+	/* Outgoing lines are built straight into nodes that any thread
+	 * pushes onto output, or onto output_priority (PONGs), which goes
+	 * out first. The thread that flips output_scheduled to true owns the
+	 * rest: it posts one drain for however many lines are pushed before
+	 * it runs, which gathers them all into output_flight and writes them
+	 * with one gather write, and keeps ownership until both queues are
+	 * empty. */
+	cq_irc::output_queue output;
+	cq_irc::output_queue output_priority;
+	std::atomic<bool> output_scheduled { false };
+	std::vector<cq_irc::output_node*> output_flight;
+	std::vector<const_buffer> output_buffers;
+
+	/* How the server currently sees us (nick!user@host). Learned from
+	 * 001, our own JOIN/NICK echoes and 396, and used to work out how
+	 * much of a line our prefix takes once the server relays it. */
+	std::mutex identity_mutex;
+	std::string nick;
+	std::string user;
+	std::string host;
+
+	cq_irc::isupport isupport;
+
+	/* Replaced whole on every change and read with atomic_load(), so the
+	 * reader and parse jobs never see one being modified. Null until
+	 * the user registers an interest. */
+	std::shared_ptr<const cq_irc::interest> interest;
+
+	/* Raw mode hands lines to signal_raw without lexing them. Only the
+	 * reader touches raw_lines, which is reused from read to read. */
+	std::atomic<bool> raw { false };
+	std::atomic<bool> auto_pong { false };
+	std::vector<cq_irc_line> raw_lines;
+
+	/* This session's parse jobs when the service has workers. */
+	cq_irc::serial_queue jobs;
+
+	/* Set once by cq_irc_session_track_state(), never cleared. */
+	std::atomic<cq_irc::state_tracker*> state { nullptr };
+
+	/* Swapped whole by cq_irc_session_use_plugin() and friends, so read
+	 * with atomic_load(); a handler holds the copy it loaded until it
+	 * returns, which keeps a plugin's library loaded under it. */
+	std::shared_ptr<const cq_irc_callbacks> callbacks;
 	struct cq_irc_service *service;
 	int use_generic = 0;
-};
\ No newline at end of file
+};
+
+namespace cq_irc {
+
+/* Messages a parse job collects for signal_batch, with the command
+ * text of those lexed generically. All of it points into the job's
+ * chunk. */
+struct parse_batch {
+	std::vector<cq_irc_message> messages;
+	std::vector<const char*> names;
+};
+
+}
+
+/* The lexer's extra data: the session a line came from, the callbacks
+ * and event bus index in force when its job started (the index null if
+ * there are no subscribers), the chunk it is being lexed in and, when
+ * the session takes batches, where its messages go. Strings interned
+ * for the job's messages are held by pins until the job hands them to
+ * the chunk; interned is the message of the current line once done.
+ * modes holds the current line's MODE changes once decoded, its memory
+ * reused from line to line. */
+struct cq_irc_parse {
+	cq_irc_session *session;
+	const cq_irc_callbacks *callbacks;
+	const cq_irc::event_index *events;
+	cq_irc_chunk *chunk;
+	cq_irc::parse_batch *batch;
+	cq_irc::pin_list *pins;
+	const cq_irc_message *interned;
+	std::vector<cq_irc_mode_change> modes;
+	bool modes_decoded;
+};
+
+/* Adds a parsed message (and its command text, which may be NULL) to
+ * the batch if the user's interest set wants it. */
+void cq_irc_parse_collect(cq_irc_parse *parse, const char *command, cq_irc_message *message);
+
+/* Whether event bus subscribers may want a message with this command;
+ * the lexer parses it for them even with no callback set. */
+bool cq_irc_parse_subscribed(cq_irc_parse *parse, const cq_irc_message *message, const char *command, std::size_t size);
+
+/* Interns the prefix components and channel target of a message about
+ * to be handed to the user, once per line. Lines nobody sees keep
+ * pointing into the chunk. */
+void cq_irc_parse_intern(cq_irc_parse *parse, cq_irc_message *message);
+
+/* Interns a string that a delivered message refers to, held until the
+ * chunk goes. */
+const char *cq_irc_parse_pin(cq_irc_parse *parse, const char *data, std::size_t size);
+
+/* The changes of the current line, a MODE message, decoded on first
+ * use so the state tracker and signal_mode share one pass. */
+const std::vector<cq_irc_mode_change> &cq_irc_parse_modes(cq_irc_parse *parse, const cq_irc_message *message);
+
+/* Hands a parsed message (and its command text, which may be NULL) to
+ * the event bus subscribers it matches. */
+void cq_irc_parse_publish(cq_irc_parse *parse, const char *command, cq_irc_message *message);
+
+/* Terminates the fields the lexer left in the chunk and fills in the
+ * ones derived from them. Called once a whole line has been lexed. */
+void cq_irc_parse_prepare(cq_irc_parse *parse, cq_irc_message *message);
+
+/* Whether the library itself needs a command, whatever the user's
+ * interest set says. */
+bool cq_irc_session_needs(cq_irc_session *session, uint16_t command, unsigned numeric);
+
+/* Whether a parsed message passes the user's interest set. */
+bool cq_irc_session_delivers(cq_irc_session *session, const char *command, const cq_irc_message *message);
+
+/* Whether the session needs to see a classified command the user has no
+ * signal_unknown for, either to learn from it or to hand it to a typed
+ * callback; the lexer skips parsing it otherwise. */
+bool cq_irc_session_wants(cq_irc_session *session, const cq_irc_callbacks &callbacks, const cq_irc_message *message);
+
+/* Called by the lexer for every command it hands to signal_unknown,
+ * whether or not the user set that callback. */
+void cq_irc_session_observe(cq_irc_parse *parse, cq_irc_message *message);
+
+/* Whether a typed callback is set for the message's command. */
+bool cq_irc_session_has_typed(const cq_irc_callbacks &callbacks, const cq_irc_message *message);
+
+/* Hands the message to its typed callback, if one is set, and reports
+ * whether it did. Messages that return false go to signal_unknown. */
+bool cq_irc_session_dispatch(cq_irc_parse *parse, cq_irc_message *message);
\ No newline at end of file
@@ -1,207 +1,2037 @@
 #include "irc-client-internal.h++"
 #include "irc-lex.h++"
-#include "format.h"
+#include "irc-casemap.h++"
+#include "irc-chunk.h++"
+#include "irc-command.h++"
+#include "irc-dispatch.h++"
+#include "irc-plugin.h++"
+#include "irc-scan.h++"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 
 namespace {
 
-	using namespace std::placeholders;
+	using namespace std::placeholders;
+
+
+
+	/* Default size of a receive chunk. A partial line too long to fit
+	 * is carried over into a chunk twice its size. */
+	const std::size_t chunk_size = 4096;
+
+	/* Offsets into a chunk: where a line starts, where its line break
+	 * starts and where the line after it starts. */
+	struct line_span {
+		uint32_t start;
+		uint32_t end;
+		uint32_t next;
+	};
+
+	/* The wanted lines from one read, lexed in place in their chunk. */
+	struct parse_job {
+		cq_irc_chunk *chunk;
+		std::vector<line_span> lines;
+		std::size_t charge = 0; /* bytes counted against the budgets */
+	};
+
+	void start_read(cq_irc_session *session);
+
+	void session_retain(cq_irc_session *session)
+	{
+		session->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void session_release(cq_irc_session *session)
+	{
+		if (session->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete session;
+	}
+
+	/* The session's callbacks as of now. Callers keep the copy until the
+	 * callback returns, so swapping tables never unloads a plugin out
+	 * from under a running handler. */
+	std::shared_ptr<const cq_irc_callbacks> current_callbacks(cq_irc_session *session)
+	{
+		return std::atomic_load(&session->callbacks);
+	}
+
+	/* A reference owned by whatever holds a copy. The worker pool still
+	 * looks at a session's serial queue after running its job and only
+	 * then destroys the job, so a job holding one of these can't free
+	 * the queue under the pool. */
+	struct session_ref {
+		explicit session_ref(cq_irc_session *_session)
+			: session(_session)
+		{
+			session_retain(session);
+		}
+
+		session_ref(const session_ref &other)
+			: session(other.session)
+		{
+			session_retain(session);
+		}
+
+		~session_ref()
+		{
+			session_release(session);
+		}
+
+		session_ref &operator=(const session_ref&) = delete;
+
+		cq_irc_session *session;
+	};
+
+	/* Lets an external event loop know there is work. */
+	void wake(cq_irc_service *service)
+	{
+		uint64_t one = 1;
+
+		if (!service->external.load(std::memory_order_acquire))
+			return;
+
+		if (write(service->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			printf("Failed to signal the service descriptor.\n");
+	}
+
+	/* Every handler the library posts goes through here, so a host
+	 * polling the service from its own loop hears of it. */
+	template <typename Handler>
+	void post_handler(cq_irc_service *service, Handler handler)
+	{
+		service->service.post(handler);
+		wake(service);
+	}
+
+	/* Adds a freshly opened socket to the service's epoll set, if a host
+	 * asked for one. Edge-triggered: the set only needs to turn readable
+	 * when something changes, the reactor does the rest. */
+	void watch_socket(cq_irc_session *session)
+	{
+		cq_irc_service *service = session->service;
+		epoll_event event = {};
+
+		if (!service->external.load(std::memory_order_acquire))
+			return;
+
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+		if (epoll_ctl(service->poll_fd, EPOLL_CTL_ADD, session->socket.native_handle(), &event) != 0)
+			printf("Failed to watch session socket.\n");
+	}
+
+	/* Quick ACK is not sticky: the kernel drops back to delayed ACKs on
+	 * its own, so it is set again after every read. */
+	void quick_ack(cq_irc_session *session)
+	{
+		int on = 1;
+
+		setsockopt(session->socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+	}
+
+	/* Empties the epoll set before the handlers run, so it turns
+	 * readable again only for what happens after. */
+	void clear_wakeups(cq_irc_service *service)
+	{
+		uint64_t count;
+		epoll_event events[64];
+
+		if (!service->external.load(std::memory_order_acquire))
+			return;
+
+		if (read(service->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			printf("Failed to clear the service descriptor.\n");
+
+		while (epoll_wait(service->poll_fd, events, 64, 0) == 64)
+			;
+	}
+
+	/* A full worker pool under CQ_IRC_QUEUE_BLOCK counts as over budget
+	 * too: the session stops reading rather than the I/O thread waiting. */
+	bool over_budget(cq_irc_session *session)
+	{
+		std::size_t session_budget = session->budget.load(std::memory_order_relaxed);
+		std::size_t service_budget = session->service->budget.load(std::memory_order_relaxed);
+		cq_irc::worker_pool *workers = session->service->workers.load();
+
+		return (session_budget && session->pending_bytes.load() > session_budget) ||
+			(service_budget && session->service->pending_bytes.load() > service_budget) ||
+			(workers && workers->full());
+	}
+
+	void charge(cq_irc_session *session, parse_job *job)
+	{
+		job->charge = offsetof(cq_irc_chunk, data) + job->chunk->capacity + cq_irc::chunk_slack;
+		session->pending_bytes += job->charge;
+		session->service->pending_bytes += job->charge;
+	}
+
+	/* Gives a finished job's bytes back and restarts whichever paused
+	 * sessions are now within budget. The counters drop before the lock
+	 * is taken, and the reader checks them under it, so a session can't
+	 * pause after its last job has already looked for it. */
+	void uncharge(cq_irc_session *session, parse_job *job)
+	{
+		cq_irc_service *service = session->service;
+
+		if (!job->charge)
+			return;
+
+		session->pending_bytes -= job->charge;
+		service->pending_bytes -= job->charge;
+
+		std::lock_guard<std::mutex> lock(service->budget_mutex);
+		std::vector<cq_irc_session*> &paused = service->paused;
+
+		for (std::size_t i = 0; i < paused.size(); ) {
+			cq_irc_session *waiting = paused[i];
+
+			if (over_budget(waiting)) {
+				++i;
+				continue;
+			}
+
+			paused[i] = paused.back();
+			paused.pop_back();
+			post_handler(service, std::bind(start_read, waiting));
+		}
+	}
+
+	/* Re-arms the read unless pending work is over budget, in which case
+	 * the session waits in the service's paused list for uncharge(). */
+	void continue_reading(cq_irc_session *session)
+	{
+		cq_irc_service *service = session->service;
+		std::lock_guard<std::mutex> lock(service->budget_mutex);
+
+		if (over_budget(session))
+			service->paused.push_back(session);
+		else
+			start_read(session);
+	}
+
+	void lex_line(cq_irc_parse *parse, const line_span &span)
+	{
+		/* Flex wants a line ending in CR LF NUL NUL. Those four bytes go
+		 * over the line break; anything of the next line they cover is
+		 * put back once this one is done. */
+		static const char tail[] = { '\r', '\n', '\0', '\0' };
+		char *base = parse->chunk->data;
+		char *line_break = base + span.end;
+		std::size_t break_size = span.next - span.end;
+		char saved[sizeof(tail)];
+
+		/* Flexical analyzer */
+		yyscan_t scanner;
+		YY_BUFFER_STATE state;
+
+		memcpy(saved, line_break, sizeof(tail));
+		memcpy(line_break, tail, sizeof(tail));
+		parse->interned = nullptr;
+		parse->modes_decoded = false;
+
+		if (yylex_init_extra(parse, &scanner) != 0) {
+			printf("Failed to initialize Flexical Analyzer.\n");
+			goto fail1;
+		}
+
+		state = yy_scan_buffer(base + span.start, span.end - span.start + sizeof(tail), scanner);
+
+		if (!state) {
+			printf("Failed to initialize Flexical state.\n");
+			goto fail0;
+		}
+
+		{
+			int result = yylex(scanner);
+
+			if (result > 0) { /* Skipped */
+				printf("Missing callback, skipped parsing stage.\n");
+			}
+			if (result < 0) { /* Error */
+				printf("Failed to parse message!\n");
+			}
+		}
+
+		yy_delete_buffer(state, scanner);
+	
+	fail0:
+		yylex_destroy(scanner);
+	fail1:
+		if (break_size < sizeof(tail))
+			memcpy(line_break + break_size, saved + break_size, sizeof(tail) - break_size);
+	}
+
+	void deliver_batch(cq_irc_session *session, const cq_irc_callbacks &callbacks, cq_irc::parse_batch &batch)
+	{
+		std::size_t count = batch.messages.size();
+		std::vector<uint16_t> commands(count), numerics(count);
+		std::vector<const char*> targets(count), trailing(count);
+		std::vector<std::size_t> target_sizes(count), trailing_sizes(count);
+
+		for (std::size_t i = 0; i < count; ++i) {
+			const cq_irc_message &message = batch.messages[i];
+			const char *target = message.params.length ? message.params.param[0] : message.trailing;
+
+			commands[i] = message.command;
+			numerics[i] = message.numeric;
+			targets[i] = target;
+			target_sizes[i] = target ? strlen(target) : 0;
+			trailing[i] = message.trailing;
+			trailing_sizes[i] = message.trailing ? strlen(message.trailing) : 0;
+		}
+
+		cq_irc_batch view = {
+			commands.data(), numerics.data(), batch.names.data(),
+			targets.data(), target_sizes.data(),
+			trailing.data(), trailing_sizes.data()
+		};
+
+		callbacks.signal_batch(session, batch.messages.data(), count, &view);
+	}
+
+	void discard_job(cq_irc_session *session, parse_job *job)
+	{
+		uncharge(session, job);
+		cq_irc::chunk_release(job->chunk);
+		delete job;
+		session_release(session);
+	}
+
+	/* Delivers the job's lines; the caller discards the job after. */
+	void parse_lines(cq_irc_session *session, parse_job *job)
+	{
+		if (session->destroyed.load())
+			return;
+
+		/* The whole job goes to one table, even if the session switches
+		 * plugins while it runs. */
+		std::shared_ptr<const cq_irc_callbacks> callbacks = current_callbacks(session);
+		std::shared_ptr<const cq_irc::event_index> events = std::atomic_load(&session->service->events);
+		cq_irc::parse_batch batch;
+		cq_irc_parse parse = {
+			session, callbacks.get(), events.get(),
+			job->chunk, callbacks->signal_batch ? &batch : nullptr,
+			nullptr, nullptr, {}, false
+		};
+
+		for (const line_span &line : job->lines) {
+			if (session->destroyed.load(std::memory_order_relaxed))
+				break;
+
+			lex_line(&parse, line);
+		}
+
+		if (!batch.messages.empty() && !session->destroyed.load())
+			deliver_batch(session, *callbacks, batch);
+
+		if (parse.pins)
+			cq_irc::pins_push(job->chunk->pins, parse.pins);
+	}
+
+	void thread_parse(cq_irc_session *session, parse_job *job)
+	{
+		parse_lines(session, job);
+		discard_job(session, job);
+	}
+
+	/* The closure a job travels in to a worker or the io_service. A job
+	 * whose closure is destroyed unrun, because a full pool dropped it or
+	 * the pool or the service went away first, is discarded all the
+	 * same. The session_ref keeps the session, and so its serial queue,
+	 * around until the closure itself is gone. */
+	std::function<void()> parse_task(cq_irc_session *session, parse_job *job)
+	{
+		session_ref ref(session);
+		std::shared_ptr<parse_job> owned(job, [session](parse_job *job) { discard_job(session, job); });
+
+		return [ref, owned]() mutable {
+			parse_lines(ref.session, owned.get());
+			owned.reset();
+		};
+	}
+
+	bool is_line_break(char c)
+	{
+		return c == '\r' || c == '\n' || c == '\0';
+	}
+
+	/* Calls func(line, size, next) for every complete line in data, next
+	 * being where the line after it starts, and returns how many bytes
+	 * those lines took. A partial line at the end is left alone. */
+	template <typename Func>
+	std::size_t for_each_line(const char *data, std::size_t size, Func func)
+	{
+		const char *end = data + size;
+		const char *p = data;
+
+		for (;;) {
+			const char *line_end = cq_irc::find_line_break(p, end - p);
+
+			if (line_end == end)
+				break;
+
+			const char *next = line_end + 1;
+
+			while (next != end && is_line_break(*next))
+				++next;
+
+			if (line_end != p)
+				func(p, static_cast<std::size_t>(line_end - p), next);
+
+			p = next;
+		}
+
+		return p - data;
+	}
+
+	/* Peeks at the command (and target) of a line still in the receive
+	 * buffer, so lines nobody is interested in are dropped before they
+	 * are copied or lexed. */
+	bool wanted(cq_irc_session *session, const char *line, std::size_t size)
+	{
+		std::shared_ptr<const cq_irc::interest> interest = std::atomic_load(&session->interest);
+		cq_irc::line_peek peek;
+		uint16_t command, numeric;
+
+		if (!interest || !cq_irc::peek_line(line, size, peek))
+			return true;
+
+		cq_irc::classify(peek.command, peek.command_size, command, numeric);
+
+		return cq_irc_session_needs(session, command, numeric) ||
+			interest->wants(command, numeric, peek.command, peek.command_size,
+				peek.target, peek.target_size, session->isupport.casemapping);
+	}
+
+	void on_read(const error_code& error, std::size_t bytes_read, cq_irc_session *session);
+
+	/* An idle session has no chunk, so it waits for the socket to become
+	 * readable and only then creates one and reads what is there. The
+	 * socket is non-blocking, so a wakeup with nothing to read just
+	 * waits again. */
+	void on_readable(const error_code& error, cq_irc_session *session)
+	{
+		if (error || session->destroyed.load()) {
+			on_read(error, 0, session);
+			return;
+		}
+
+		error_code read_error;
+		cq_irc_chunk *chunk = cq_irc::chunk_create(chunk_size);
+		std::size_t bytes_read = session->socket.read_some(
+			buffer(static_cast<void*>(chunk->data), chunk->capacity), read_error);
+
+		if (read_error == error::would_block) {
+			cq_irc::chunk_release(chunk);
+			start_read(session);
+			return;
+		}
+
+		session->input = chunk;
+		on_read(read_error, bytes_read, session);
+	}
+
+	void start_read(cq_irc_session *session)
+	{
+		cq_irc_chunk *chunk = session->input;
+
+		if (!chunk) {
+			session->socket.async_read_some(null_buffers(),
+				std::bind(on_readable, _1, session));
+			return;
+		}
+
+		session->socket.async_read_some(
+			buffer(chunk->data + chunk->size, chunk->capacity - chunk->size),
+			std::bind(on_read, _1, _2, session));
+	}
+
+	/* Makes sure the reader has somewhere to read to. Once everything in
+	 * the chunk has been consumed the session lets go of it and goes back
+	 * to idle. A chunk handed to a parse job (or pinned by retained
+	 * messages) is left to them: its partial line is carried over into a
+	 * fresh chunk, so the reader never writes where a job may be lexing. */
+	void make_room(cq_irc_session *session)
+	{
+		cq_irc_chunk *chunk = session->input;
+		std::size_t partial = chunk->size - session->input_start;
+		bool shared = chunk->refs.load(std::memory_order_acquire) > 1;
+
+		if (partial == 0) {
+			session->input = nullptr;
+			session->input_start = 0;
+			cq_irc::chunk_release(chunk);
+			return;
+		}
+
+		if (!shared) {
+			if (chunk->size < chunk->capacity)
+				return;
+
+			if (partial <= chunk->capacity / 2) {
+				memmove(chunk->data, chunk->data + session->input_start, partial);
+				chunk->size = partial;
+				session->input_start = 0;
+				return;
+			}
+		}
+
+		std::size_t capacity = chunk_size;
+
+		while (capacity < partial * 2)
+			capacity *= 2;
+
+		cq_irc_chunk *next = cq_irc::chunk_create(capacity);
+
+		memcpy(next->data, chunk->data + session->input_start, partial);
+		next->size = partial;
+
+		session->input = next;
+		session->input_start = 0;
+		cq_irc::chunk_release(chunk);
+	}
+
+	/* Whether a line is a PING and, if so, what to answer it with. */
+	bool peek_ping(const char *line, std::size_t size, cq_irc::piece &token)
+	{
+		cq_irc::line_peek peek;
+		uint16_t command, numeric;
+
+		if (!cq_irc::peek_line(line, size, peek))
+			return false;
+
+		cq_irc::classify(peek.command, peek.command_size, command, numeric);
+
+		if (command != CQ_IRC_COMMAND_PING)
+			return false;
+
+		token = cq_irc::arg(peek.target ? peek.target : "", peek.target_size);
+
+		return true;
+	}
+
+	void answer_ping(cq_irc_session *session, const cq_irc::piece &token);
+
+	/* Notes lines over the session's limit so on_read() can apply the
+	 * overflow policy; they are never delivered. */
+	bool too_long(cq_irc_session *session, std::size_t size)
+	{
+		std::size_t max_line = session->max_line.load(std::memory_order_relaxed);
+
+		if (!max_line || size <= max_line)
+			return false;
+
+		session->overflowed = true;
+
+		return true;
+	}
+
+	/* After an overlong partial line was thrown away, skips whatever
+	 * arrives of it until its line break. */
+	void skip_overflow(cq_irc_session *session)
+	{
+		cq_irc_chunk *chunk = session->input;
+		const char *start = chunk->data + session->input_start;
+		const char *end = chunk->data + chunk->size;
+		const char *line_break = cq_irc::find_line_break(start, end - start);
+
+		session->input_start = line_break - chunk->data;
+		session->discarding = line_break == end;
+	}
+
+	/* Applies the overflow policy once a line has gone over the limit,
+	 * whether it arrived whole or is still arriving. Returns false if
+	 * the session was disconnected. */
+	bool check_overflow(cq_irc_session *session)
+	{
+		cq_irc_chunk *chunk = session->input;
+		std::size_t max_line = session->max_line.load(std::memory_order_relaxed);
+
+		if (max_line && chunk->size - session->input_start > max_line) {
+			session->overflowed = true;
+			session->input_start = chunk->size;
+			session->discarding = true;
+		}
+
+		if (!session->overflowed)
+			return true;
+
+		session->overflowed = false;
+
+		if (session->overflow_policy.load(std::memory_order_relaxed) != CQ_IRC_OVERFLOW_DISCONNECT)
+			return true;
+
+		error_code ignored;
+
+		printf("Line too long, disconnecting.\n");
+		session->socket.shutdown(ip::tcp::socket::shutdown_both, ignored);
+		session->socket.close(ignored);
+		current_callbacks(session)->signal_disconnect(session);
+
+		return false;
+	}
+
+	/* Hands every complete line in the chunk to signal_raw in one call,
+	 * as slices of the chunk itself. */
+	void deliver_raw(cq_irc_session *session, const cq_irc_callbacks &callbacks)
+	{
+		cq_irc_chunk *chunk = session->input;
+		std::vector<cq_irc_line> &lines = session->raw_lines;
+		bool auto_pong = session->auto_pong.load(std::memory_order_relaxed);
+
+		lines.clear();
+
+		session->input_start += for_each_line(
+			chunk->data + session->input_start, chunk->size - session->input_start,
+			[&](const char *line, std::size_t size, const char*) {
+				cq_irc::piece token;
+
+				if (too_long(session, size))
+					return;
+
+				if (auto_pong && peek_ping(line, size, token))
+					answer_ping(session, token);
+
+				lines.push_back(cq_irc_line { line, size });
+			});
+
+		if (!lines.empty())
+			callbacks.signal_raw(session, lines.data(), lines.size());
+	}
+
+	void add_line(parse_job *&job, cq_irc_chunk *chunk, const char *line, std::size_t size, const char *next)
+	{
+		if (!job) {
+			job = new parse_job;
+			job->chunk = chunk;
+			cq_irc::chunk_retain(chunk);
+		}
+
+		job->lines.push_back(line_span {
+			static_cast<uint32_t>(line - chunk->data),
+			static_cast<uint32_t>(line + size - chunk->data),
+			static_cast<uint32_t>(next - chunk->data)
+		});
+	}
+
+	/* Gathers every complete line the session wants into a parse job
+	 * that shares the chunk, so a read costs one posted handler however
+	 * many lines it brought and nothing is copied. With pings non-null,
+	 * PING lines go to a job of their own. With auto-PONG on, PINGs are
+	 * answered here, before anything queued gets a chance to run. */
+	parse_job *collect_lines(cq_irc_session *session, parse_job **pings)
+	{
+		cq_irc_chunk *chunk = session->input;
+		bool auto_pong = session->auto_pong.load(std::memory_order_relaxed);
+		parse_job *job = nullptr;
+
+		session->input_start += for_each_line(
+			chunk->data + session->input_start, chunk->size - session->input_start,
+			[&](const char *line, std::size_t size, const char *next) {
+				if (too_long(session, size))
+					return;
+
+				cq_irc::piece token;
+				bool ping = (pings || auto_pong) && peek_ping(line, size, token);
+
+				if (ping && auto_pong)
+					answer_ping(session, token);
+
+				if (!wanted(session, line, size))
+					return;
+
+				if (ping && pings)
+					add_line(*pings, chunk, line, size, next);
+				else
+					add_line(job, chunk, line, size, next);
+			});
+
+		return job;
+	}
+
+	void on_read(
+	  const error_code& error,
+	  std::size_t bytes_read,
+	  cq_irc_session *session)
+	{
+		if (session->destroyed.load()) {
+			session_release(session);
+			return;
+		}
+
+		if (error == error::eof ) {
+			current_callbacks(session)->signal_disconnect(session);
+			session_release(session);
+			return;
+		} else if (error == error::operation_aborted) {
+			if (!session->socket.is_open()) {
+				current_callbacks(session)->signal_disconnect(session);
+				printf("Connection closed by client.\n");
+				session_release(session);
+				return;
+			}
+		} else if (error) {
+			printf("Reading Error: %s\n", error.message().c_str());
+			session_release(session);
+			return;
+		}
+
+		session->input->size += bytes_read;
+
+		if (session->service->low_latency.load(std::memory_order_relaxed))
+			quick_ack(session);
+
+		if (session->discarding)
+			skip_overflow(session);
+
+		cq_irc::worker_pool *workers = session->service->workers.load();
+		parse_job *job = nullptr;
+		parse_job *pings = nullptr;
+
+		std::shared_ptr<const cq_irc_callbacks> callbacks = current_callbacks(session);
+
+		if (session->raw.load(std::memory_order_relaxed) && callbacks->signal_raw)
+			deliver_raw(session, *callbacks);
+		else
+			job = collect_lines(session, workers ? &pings : nullptr);
+
+		/* Keepalives don't wait behind callbacks: PINGs are handled right
+		 * here, before anything else can touch the chunk. */
+		if (pings) {
+			session_retain(session);
+			thread_parse(session, pings);
+		}
+
+		bool connected = check_overflow(session);
+
+		/* Before the job is posted: it may write past its last line. */
+		make_room(session);
+
+		if (job) {
+			session_retain(session);
+			charge(session, job);
+		}
+
+		if (job && workers)
+			workers->submit(session->jobs, parse_task(session, job));
+		else if (job)
+			post_handler(session->service, parse_task(session, job));
+
+		if (connected)
+			continue_reading(session);
+		else
+			session_release(session);
+	}
+
+	void try_connect(cq_irc_session *session, ip::tcp::resolver::iterator iterator);
+
+	void set_low_latency(cq_irc_session *session)
+	{
+		cq_irc_service *service = session->service;
+		int busy_poll = service->busy_poll_us.load(std::memory_order_relaxed);
+		error_code error;
+
+		session->socket.set_option(ip::tcp::no_delay(true), error);
+
+		if (error)
+			printf("Failed to set TCP_NODELAY: %s\n", error.message().c_str());
+
+		quick_ack(session);
+
+		if (busy_poll && setsockopt(session->socket.native_handle(),
+			SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0)
+			printf("Failed to set SO_BUSY_POLL.\n");
+	}
+
+	void on_connect(
+		const error_code& error,
+		ip::tcp::resolver::iterator iterator,
+		cq_irc_session *session)
+	{
+		if (session->destroyed.load()) {
+			session_release(session);
+			return;
+		}
+
+		if (error) {
+			if (++iterator != ip::tcp::resolver::iterator()) {
+				try_connect(session, iterator);
+				return;
+			}
+
+			printf("Connection Error: %s\n", error.message().c_str());
+			session_release(session);
+			return;
+		}
+
+		if (session->service->low_latency.load(std::memory_order_relaxed))
+			set_low_latency(session);
+
+		current_callbacks(session)->signal_connect(session);
+		session->socket.non_blocking(true);
+
+		start_read(session);
+	}
+
+	/* Tries the resolved endpoints in turn, as async_connect() would,
+	 * but opens the socket itself so it can be watched before the
+	 * connect is started. */
+	void try_connect(cq_irc_session *session, ip::tcp::resolver::iterator iterator)
+	{
+		error_code error;
+
+		for (; iterator != ip::tcp::resolver::iterator(); ++iterator) {
+			session->socket.close(error);
+			session->socket.open(iterator->endpoint().protocol(), error);
+
+			if (!error)
+				break;
+		}
+
+		if (error) {
+			printf("Connection Error: %s\n", error.message().c_str());
+			session_release(session);
+			return;
+		}
+
+		watch_socket(session);
+
+		session->socket.async_connect(*iterator,
+			std::bind(on_connect, _1, iterator, session));
+	}
+
+	void on_resolve(
+		const error_code& error, 
+		ip::tcp::resolver::iterator iterator,
+		cq_irc_session *session)
+	{
+		if (session->destroyed.load()) {
+			session_release(session);
+			return;
+		}
+
+		if (error) {
+			printf("Resolver error: %s\n", error.message().c_str());
+			session_release(session);
+			return;
+		}
+
+		try_connect(session, iterator);
+	}
+
+	/* Runs on the service's resolve thread. */
+	void resolve(cq_irc_session *session, const ip::tcp::resolver::query &query)
+	{
+		error_code error;
+		ip::tcp::resolver::iterator iterator = session->service->resolver.resolve(query, error);
+
+		post_handler(session->service, std::bind(on_resolve, error, iterator, session));
+	}
+
+	void on_write(const error_code& error, std::size_t, cq_irc_session *session);
+
+	/* Runs on an I/O thread for as long as this session's output is
+	 * scheduled. Everything pushed so far, PONGs first, goes out in one
+	 * gather write; once both queues are empty the session gives up
+	 * output_scheduled, and takes it back if a line slipped in while
+	 * it did. The drain holds a reference to the session for as long
+	 * as it is scheduled. */
+	void drain_output(cq_irc_session *session)
+	{
+		for (;;) {
+			cq_irc::output_node *node;
+
+			while ((node = session->output_priority.pop()))
+				session->output_flight.push_back(node);
+
+			while ((node = session->output.pop()))
+				session->output_flight.push_back(node);
+
+			if (!session->output_flight.empty()) {
+				for (cq_irc::output_node *flight : session->output_flight)
+					session->output_buffers.push_back(buffer(static_cast<const void*>(flight->data), flight->size));
+
+				async_write(
+					session->socket,
+					session->output_buffers,
+					std::bind(on_write, _1, _2, session));
+				return;
+			}
+
+			/* A producer is between its two steps; it's about to finish. */
+			if (!session->output_priority.empty() || !session->output.empty()) {
+				post_handler(session->service, std::bind(drain_output, session));
+				return;
+			}
+
+			session->output_scheduled.store(false);
+
+			if ((!session->output_priority.has_pushes() && !session->output.has_pushes()) ||
+			    session->output_scheduled.exchange(true)) {
+				session_release(session);
+				return;
+			}
+		}
+	}
+
+	void on_write(const error_code& error, std::size_t, cq_irc_session *session)
+	{
+		if (error) {
+			printf("Write error: %s\n", error.message().c_str());
+		}
+
+		for (cq_irc::output_node *node : session->output_flight)
+			cq_irc::output_free(node);
+
+		session->output_flight.clear();
+		session->output_buffers.clear();
+
+		drain_output(session);
+	}
+
+	/* Hands a node to the session from any thread. Only the push that
+	 * finds the output idle posts a drain. */
+	void send_output(cq_irc_session *session, cq_irc::output_queue &queue, cq_irc::output_node *node)
+	{
+		/* Someone still holding a looked-up reference. */
+		if (session->destroyed.load()) {
+			cq_irc::output_free(node);
+			return;
+		}
+
+		queue.push(node);
+
+		if (!session->output_scheduled.exchange(true)) {
+			session_retain(session);
+			post_handler(session->service, std::bind(drain_output, session));
+		}
+	}
+
+	void send_output(cq_irc_session *session, cq_irc::output_node *node)
+	{
+		send_output(session, session->output, node);
+	}
+
+	/* Builds the line straight into an output node. */
+	template <typename... Pieces>
+	void write_line(cq_irc_session *session, const Pieces&... pieces)
+	{
+		std::size_t size = cq_irc::line_size(pieces...);
+		cq_irc::output_node *node = cq_irc::output_create(size + 2);
+
+		memcpy(cq_irc::build_line(node->data, pieces...), "\r\n", 2);
+
+		send_output(session, node);
+	}
+
+	/* As write_line, but ahead of everything not yet being written. */
+	template <typename... Pieces>
+	void write_priority_line(cq_irc_session *session, const Pieces&... pieces)
+	{
+		std::size_t size = cq_irc::line_size(pieces...);
+		cq_irc::output_node *node = cq_irc::output_create(size + 2);
+
+		memcpy(cq_irc::build_line(node->data, pieces...), "\r\n", 2);
+
+		send_output(session, session->output_priority, node);
+	}
+
+	void answer_ping(cq_irc_session *session, const cq_irc::piece &token)
+	{
+		write_priority_line(session, "PONG :", token);
+	}
+
+	bool valid_middle(const cq_irc::piece &p)
+	{
+		return p.size != 0 && p.data[0] != ':' &&
+			cq_irc::find_param_break(p.data, p.size) == p.data + p.size;
+	}
+
+	bool valid_trailing(const cq_irc::piece &p)
+	{
+		return cq_irc::find_line_break(p.data, p.size) == p.data + p.size;
+	}
+
+	/* Servers cut relayed lines at LINELEN (512 unless advertised), CRLF
+	 * and our prefix included. */
+	std::size_t line_limit(cq_irc_session *session)
+	{
+		return session->isupport.linelen - 2;
+	}
+
+	/* Assumed when we don't know our own prefix yet. */
+	const std::size_t default_nick_size = 30;
+	const std::size_t default_user_size = 11; /* USERLEN plus a leading ~ */
+	const std::size_t default_host_size = 63;
+
+	/* Size of ":nick!user@host " as the server will prepend it. */
+	std::size_t own_prefix_size(cq_irc_session *session)
+	{
+		std::lock_guard<std::mutex> lock(session->identity_mutex);
+
+		std::size_t nick = session->nick.empty() ? default_nick_size : session->nick.size();
+		std::size_t user = session->user.empty() ? default_user_size : session->user.size();
+		std::size_t host = session->host.empty() ? default_host_size : session->host.size();
+
+		return nick + user + host + 4;
+	}
+
+	bool is_utf8_continuation(char c)
+	{
+		return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+	}
+
+	/* Where to end a chunk of at most budget bytes: after the last space
+	 * if there is one, otherwise on a code point boundary. */
+	std::size_t split_point(const char *text, std::size_t budget)
+	{
+		const char *space = cq_irc::find_last_space(text, budget + 1);
+
+		if (space != text + budget + 1 && space != text)
+			return space - text;
+
+		std::size_t cut = budget;
+
+		while (cut > 0 && is_utf8_continuation(text[cut]))
+			--cut;
+
+		return cut ? cut : budget;
+	}
+
+	/* Cuts text into chunks for "<command> <target> :<chunk>" lines that
+	 * each stay under the wire limit once prefix bytes are prepended, and
+	 * adds the bytes the lines take to size. Fails if not even one byte
+	 * of text fits next to the target. */
+	bool split_text(cq_irc_session *session, std::size_t prefix, const cq_irc::piece &cmd,
+		const cq_irc::piece &dest, cq_irc::piece text, std::vector<cq_irc::piece> &chunks, std::size_t &size)
+	{
+		/* "<command> <target> :" around every chunk */
+		std::size_t framing = cmd.size + dest.size + 3;
+		std::size_t overhead = prefix + framing;
+		std::size_t limit = line_limit(session);
+
+		if (overhead >= limit)
+			return false;
+
+		std::size_t budget = limit - overhead;
+
+		do {
+			std::size_t length = text.size;
+
+			if (length > budget)
+				length = split_point(text.data, budget);
+
+			chunks.push_back(cq_irc::arg(text.data, length));
+			size += framing + length + 2;
+
+			/* The space we split on is not sent. */
+			if (length < text.size && text.data[length] == ' ')
+				++length;
+
+			text.data += length;
+			text.size -= length;
+		} while (text.size);
+
+		return true;
+	}
+
+	char *build_split(char *out, const cq_irc::piece &cmd, const cq_irc::piece &dest, const std::vector<cq_irc::piece> &chunks)
+	{
+		for (const cq_irc::piece &chunk : chunks)
+			out = cq_irc::build_line(out, cmd, " ", dest, " :", chunk, "\r\n");
+
+		return out;
+	}
+
+	/* Queues text as as many "<command> <target> :<chunk>" lines as it
+	 * takes to keep each under the wire limit, all in one batch. */
+	int write_split(cq_irc_session *session, const char *command, const char *target, const char *message)
+	{
+		cq_irc::piece cmd = cq_irc::arg(command);
+		cq_irc::piece dest = cq_irc::arg(target);
+		cq_irc::piece text = cq_irc::arg(message);
+		std::vector<cq_irc::piece> chunks;
+		std::size_t size = 0;
+
+		if (!valid_middle(dest) || !valid_trailing(text) ||
+		    !split_text(session, own_prefix_size(session), cmd, dest, text, chunks, size))
+			return -1;
+
+		cq_irc::output_node *node = cq_irc::output_create(size);
+
+		build_split(node->data, cmd, dest, chunks);
+		send_output(session, node);
+
+		return 0;
+	}
+
+	/* Sends message to every target, packing as many targets into each
+	 * line as TARGMAX and the line length allow. Targets that can't share
+	 * a line with the message are split as write_split() would, after the
+	 * packed lines. Everything is checked and planned first, then built
+	 * into one node, so the call either queues all of its lines in one
+	 * batch or none. */
+	int write_fanout(cq_irc_session *session, const char *command, const char **targets, int ntargets, const char *message)
+	{
+		bool notice = strcmp(command, "NOTICE") == 0;
+		cq_irc::piece cmd = cq_irc::arg(command);
+		cq_irc::piece text = cq_irc::arg(message);
+		std::vector<cq_irc::piece> dests(ntargets > 0 ? ntargets : 0);
+
+		if (ntargets < 0 || !valid_trailing(text))
+			return -1;
+
+		for (int i = 0; i < ntargets; ++i) {
+			dests[i] = cq_irc::arg(targets[i]);
+
+			if (!valid_middle(dests[i]) || memchr(dests[i].data, ',', dests[i].size))
+				return -1;
+		}
+
+		unsigned max_targets = session->isupport.targets_for(notice);
+		std::size_t limit = line_limit(session);
+		std::size_t prefix = own_prefix_size(session);
+
+		/* "<command> " + " :<message>" + what the prefix costs us */
+		std::size_t fixed = prefix + cmd.size + text.size + 3;
+
+		/* [first, last) ranges of dests, one per line */
+		std::vector<std::pair<int, int>> lines;
+		/* Targets too long to share a line, each with its chunks. */
+		std::vector<std::pair<int, std::vector<cq_irc::piece>>> oversized;
+		std::size_t size = 0;
+
+		for (int first = 0; first < ntargets; ) {
+			std::size_t used = fixed + dests[first].size;
+			int last = first + 1;
+
+			if (used > limit) {
+				oversized.push_back(std::make_pair(first, std::vector<cq_irc::piece>()));
+
+				if (!split_text(session, prefix, cmd, dests[first], text, oversized.back().second, size))
+					return -1;
+
+				first = last;
+				continue;
+			}
+
+			while (last < ntargets && unsigned(last - first) < max_targets &&
+			       used + dests[last].size + 1 <= limit) {
+				used += dests[last].size + 1;
+				++last;
+			}
+
+			lines.push_back(std::make_pair(first, last));
+			size += used - prefix + 2;
+			first = last;
+		}
+
+		if (!size)
+			return 0;
+
+		cq_irc::output_node *node = cq_irc::output_create(size);
+		char *out = node->data;
+
+		for (const std::pair<int, int> &line : lines) {
+			out = cq_irc::build_line(out, cmd, " ", dests[line.first]);
+
+			for (int i = line.first + 1; i < line.second; ++i)
+				out = cq_irc::build_line(out, ",", dests[i]);
+
+			out = cq_irc::build_line(out, " :", text, "\r\n");
+		}
+
+		for (const std::pair<int, std::vector<cq_irc::piece>> &split : oversized)
+			out = build_split(out, cmd, dests[split.first], split.second);
+
+		send_output(session, node);
+
+		return 0;
+	}
+
+	/* attach(): with no spin window, just io_service::run(). Otherwise
+	 * handlers are polled for until spin_us passes without any, and only
+	 * then does the thread block for the next one. */
+	void run_service(cq_irc_service *service)
+	{
+		typedef std::chrono::steady_clock clock;
+		io_service &io = service->service;
+		unsigned spin_us = service->spin_us.load(std::memory_order_relaxed);
+
+		if (!spin_us) {
+			io.run();
+			return;
+		}
+
+		std::chrono::microseconds window(spin_us);
+		clock::time_point last_work = clock::now();
+
+		while (!io.stopped()) {
+			if (io.poll()) {
+				last_work = clock::now();
+				continue;
+			}
+
+			if (clock::now() - last_work < window)
+				continue;
+
+			if (!io.run_one())
+				break;
+
+			last_work = clock::now();
+		}
+	}
+
+	/* Finds the service's copy of a callback table, making one if no
+	 * live session uses an identical table, so a hundred thousand
+	 * sessions with the same callbacks hold one table between them. */
+	std::shared_ptr<const cq_irc_callbacks> share_callbacks(
+		cq_irc_service *service, const cq_irc_callbacks &callbacks)
+	{
+		std::lock_guard<std::mutex> lock(service->callbacks_mutex);
+		std::vector<std::weak_ptr<const cq_irc_callbacks>> &tables = service->callback_tables;
+
+		for (std::size_t i = 0; i < tables.size(); ) {
+			std::shared_ptr<const cq_irc_callbacks> table = tables[i].lock();
+
+			if (!table) {
+				tables[i] = tables.back();
+				tables.pop_back();
+				continue;
+			}
+
+			if (memcmp(table.get(), &callbacks, sizeof(callbacks)) == 0)
+				return table;
+
+			++i;
+		}
+
+		std::shared_ptr<const cq_irc_callbacks> table =
+			std::make_shared<cq_irc_callbacks>(callbacks);
+
+		tables.push_back(table);
+
+		return table;
+	}
+
+	template <typename Change>
+	void update_interest(cq_irc_session *session, Change change)
+	{
+		std::shared_ptr<const cq_irc::interest> current = std::atomic_load(&session->interest);
+		std::shared_ptr<const cq_irc::interest> next;
+
+		do {
+			std::shared_ptr<cq_irc::interest> copy = current ?
+				std::make_shared<cq_irc::interest>(*current) :
+				std::make_shared<cq_irc::interest>();
+
+			change(*copy);
+			next = copy;
+		} while (!std::atomic_compare_exchange_weak(&session->interest, &current, next));
+	}
+
+	/* Compiles the service's subscriptions into a new index. Called with
+	 * events_mutex held. */
+	void rebuild_events(cq_irc_service *service)
+	{
+		std::shared_ptr<const cq_irc::event_index> index;
+
+		if (service->subscriptions.size() != 0) {
+			index = std::make_shared<cq_irc::event_index>(
+				std::vector<std::shared_ptr<const cq_irc::subscription>>(
+					service->subscriptions.begin(), service->subscriptions.end()));
+		}
+
+		std::atomic_store(&service->events, index);
+	}
+
+	cq_irc_session *connect_session(
+		cq_irc_service *service, const char *host, const char *port,
+		std::shared_ptr<const cq_irc_callbacks> callbacks)
+	{
+		cq_irc_session *session = new cq_irc_session(service);
+		ip::tcp::resolver::query query(host, port);
+
+		session->callbacks = std::move(callbacks);
+
+		{
+			std::lock_guard<std::mutex> lock(service->sessions_mutex);
+
+			session->handle = service->sessions.insert(session);
+
+			if (service->sessions.size() == 1)
+				service->work.reset(new io_service::work(service->service));
+		}
+
+		std::call_once(service->resolve_started, [service]() {
+			service->resolve_work.reset(new io_service::work(service->resolve_service));
+			service->resolve_thread = std::thread([service]() {
+				service->resolve_service.run();
+			});
+		});
+
+		/* For the handlers that connect and then read. */
+		session_retain(session);
+		service->resolve_service.post(std::bind(resolve, session, query));
+
+		return session;
+	}
+}
+
+void cq_irc_parse_collect(cq_irc_parse *parse, const char *command, cq_irc_message *message)
+{
+	if (!cq_irc_session_delivers(parse->session, command, message))
+		return;
+
+	cq_irc_parse_intern(parse, message);
+	parse->batch->messages.push_back(*message);
+	parse->batch->names.push_back(command);
+}
+
+bool cq_irc_parse_subscribed(cq_irc_parse *parse, const cq_irc_message *message, const char *command, std::size_t size)
+{
+	return parse->events && parse->events->wants(message->command, message->numeric, command, size);
+}
+
+void cq_irc_parse_publish(cq_irc_parse *parse, const char *command, cq_irc_message *message)
+{
+	if (!parse->events || !cq_irc_session_delivers(parse->session, command, message))
+		return;
+
+	cq_irc_parse_intern(parse, message);
+
+	if (message->command != CQ_IRC_COMMAND_UNKNOWN)
+		command = nullptr;
+
+	parse->events->publish(parse->session, command, message, parse->session->isupport.casemapping);
+}
+
+void cq_irc_parse_prepare(cq_irc_parse *parse, cq_irc_message *message)
+{
+	/* The lexer leaves fields pointing into the chunk; end them where
+	 * the next separator or the line break starts. */
+	for (int i = 0; i < message->params.length; ++i) {
+		char *param = message->params.param[i];
+
+		param[strcspn(param, " \r\n")] = '\0';
+	}
+
+	if (message->trailing)
+		message->trailing[strcspn(message->trailing, "\r\n")] = '\0';
+
+	/* Prefix components run up to the next of "!@ ". */
+	if (message->prefix.source) {
+		char *source = const_cast<char*>(message->prefix.source);
+
+		source[strcspn(source, "!@ ")] = '\0';
+	}
+
+	if (message->prefix.user) {
+		char *user = const_cast<char*>(message->prefix.user);
+
+		user[strcspn(user, "@ ")] = '\0';
+	}
+
+	if (message->prefix.host) {
+		char *host = const_cast<char*>(message->prefix.host);
+
+		host[strcspn(host, " ")] = '\0';
+	}
+
+	message->chunk = parse->chunk;
+}
+
+const std::vector<cq_irc_mode_change> &cq_irc_parse_modes(cq_irc_parse *parse, const cq_irc_message *message)
+{
+	if (!parse->modes_decoded) {
+		parse->modes.clear();
+		cq_irc::decode_modes(parse->session->isupport, message, parse->modes);
+		parse->modes_decoded = true;
+	}
+
+	return parse->modes;
+}
+
+const char *cq_irc_parse_pin(cq_irc_parse *parse, const char *data, std::size_t size)
+{
+	if (!parse->pins)
+		parse->pins = new cq_irc::pin_list(parse->session->service->strings);
+
+	return parse->pins->intern(data, size);
+}
+
+void cq_irc_parse_intern(cq_irc_parse *parse, cq_irc_message *message)
+{
+	if (parse->interned == message)
+		return;
+
+	parse->interned = message;
+
+	cq_irc_prefix &prefix = message->prefix;
+
+	if (prefix.source)
+		prefix.source = cq_irc_parse_pin(parse, prefix.source, strlen(prefix.source));
+	if (prefix.user)
+		prefix.user = cq_irc_parse_pin(parse, prefix.user, strlen(prefix.user));
+	if (prefix.host)
+		prefix.host = cq_irc_parse_pin(parse, prefix.host, strlen(prefix.host));
+
+	const char *first = message->params.length ? message->params.param[0] : message->trailing;
+
+	if (parse->session->isupport.is_channel(first))
+		message->target = cq_irc_parse_pin(parse, first, strlen(first));
+}
+
+bool cq_irc_session_needs(cq_irc_session *session, uint16_t command, unsigned numeric)
+{
+	switch (command) {
+	case CQ_IRC_COMMAND_PING:
+	case CQ_IRC_COMMAND_JOIN:
+	case CQ_IRC_COMMAND_NICK:
+		return true;
+	case CQ_IRC_COMMAND_PART:
+	case CQ_IRC_COMMAND_KICK:
+	case CQ_IRC_COMMAND_QUIT:
+	case CQ_IRC_COMMAND_MODE:
+	case CQ_IRC_COMMAND_TOPIC:
+		if (session->state.load())
+			return true;
+		break;
+	case CQ_IRC_COMMAND_NUMERIC:
+		switch (numeric) {
+		case 1: case 5: case 396:
+			return true;
+		case 332: case 353:
+			if (session->state.load())
+				return true;
+			break;
+		}
+		break;
+	}
+
+	return false;
+}
+
+bool cq_irc_session_delivers(cq_irc_session *session, const char *command, const cq_irc_message *message)
+{
+	std::shared_ptr<const cq_irc::interest> interest = std::atomic_load(&session->interest);
+
+	if (!interest || message->command == CQ_IRC_COMMAND_PING)
+		return true;
+
+	const char *target = message->params.length ? message->params.param[0] : message->trailing;
+
+	return interest->wants(message->command, message->numeric,
+		command, command ? strlen(command) : 0,
+		target, target ? strlen(target) : 0,
+		session->isupport.casemapping);
+}
+
+bool cq_irc_session_wants(cq_irc_session *session, const cq_irc_callbacks &callbacks, const cq_irc_message *message)
+{
+	return cq_irc_session_needs(session, message->command, message->numeric) ||
+		cq_irc_session_has_typed(callbacks, message);
+}
+
+void cq_irc_session_observe(cq_irc_parse *parse, cq_irc_message *message)
+{
+	cq_irc_session *session = parse->session;
+	cq_irc::state_tracker *state = session->state.load();
+	std::string our_nick;
+
+	{
+		std::lock_guard<std::mutex> lock(session->identity_mutex);
+		const char *source = message->prefix.source;
+		bool from_us = source && cq_irc::casecmp(source, strlen(source),
+			session->nick.data(), session->nick.size(), session->isupport.casemapping) == 0;
+
+		our_nick = session->nick;
+
+		switch (message->command) {
+		case CQ_IRC_COMMAND_NICK:
+			if (!from_us)
+				break;
+			if (message->params.length > 0)
+				session->nick = message->params.param[0];
+			else if (message->trailing)
+				session->nick = message->trailing;
+			break;
+		case CQ_IRC_COMMAND_JOIN:
+			if (!from_us)
+				break;
+			if (message->prefix.user)
+				session->user = message->prefix.user;
+			if (message->prefix.host)
+				session->host = message->prefix.host;
+			break;
+		case CQ_IRC_COMMAND_NUMERIC:
+			if (message->numeric == 1) {
+				if (message->params.length > 0)
+					session->nick = message->params.param[0];
+			} else if (message->numeric == 5) {
+				/* The first parameter is our nick, the rest are tokens. */
+				for (int i = 1; i < message->params.length; ++i)
+					cq_irc::isupport_parse(session->isupport, message->params.param[i]);
+			} else if (message->numeric == 396) {
+				if (message->params.length > 1)
+					session->host = message->params.param[1];
+			}
+			break;
+		}
+	}
+
+	if (state) {
+		const std::vector<cq_irc_mode_change> *modes = nullptr;
+
+		if (message->command == CQ_IRC_COMMAND_MODE)
+			modes = &cq_irc_parse_modes(parse, message);
+
+		state->observe(our_nick, message, modes);
+	}
+}
+
+extern "C" {
+
+cq_irc_session *cq_irc_session_connect(
+	struct cq_irc_service* service,
+	const char* host, 
+	const char *port,
+	struct cq_irc_callbacks* callbacks)
+{
+	return connect_session(service, host, port, share_callbacks(service, *callbacks));
+}
+
+cq_irc_session *cq_irc_session_connect_plugin(
+	struct cq_irc_service *service,
+	const char *host,
+	const char *port,
+	struct cq_irc_plugin *plugin)
+{
+	return connect_session(service, host, port, plugin->callbacks);
+}
+
+/* The socket belongs to the I/O threads, which may be reading or
+ * writing it right now, so it is closed from there. */
+void cq_irc_session_disconnect(struct cq_irc_session *session)
+{
+	session_ref ref(session);
+
+	post_handler(session->service, [ref]() {
+		error_code ignored;
+
+		ref.session->socket.shutdown(ip::tcp::socket::shutdown_both, ignored);
+		ref.session->socket.close(ignored);
+	});
+}
+
+void cq_irc_session_destroy(struct cq_irc_session *session)
+{
+	cq_irc_service *service = session->service;
+	bool was_paused;
+
+	/* Anyone holding a looked-up reference may get here; the first call
+	 * does the work. */
+	if (session->destroyed.exchange(true))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(service->budget_mutex);
+		std::vector<cq_irc_session*> &paused = service->paused;
+		std::vector<cq_irc_session*>::iterator last = std::remove(paused.begin(), paused.end(), session);
+
+		was_paused = last != paused.end();
+		paused.erase(last, paused.end());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(service->sessions_mutex);
+
+		service->sessions.remove(session->handle);
+
+		if (service->sessions.size() == 0)
+			service->work.reset();
+	}
+
+	/* Closed on an I/O thread, like in cq_irc_session_disconnect().
+	 * Whatever the reader is waiting on completes and, seeing the
+	 * session destroyed, lets go of it; the handler holds the last
+	 * reference the caller had. */
+	session_ref ref(session);
+
+	post_handler(service, [ref]() {
+		error_code ignored;
+
+		ref.session->socket.close(ignored);
+	});
+
+	if (was_paused)
+		session_release(session);
+
+	session_release(session);
+}
+
+cq_irc_handle cq_irc_session_handle(struct cq_irc_session *session)
+{
+	return session->handle;
+}
+
+struct cq_irc_session *cq_irc_session_from_handle(struct cq_irc_service *service, cq_irc_handle handle)
+{
+	std::lock_guard<std::mutex> lock(service->sessions_mutex);
+	cq_irc_session **session = service->sessions.find(handle);
+
+	if (!session)
+		return nullptr;
+
+	/* Still in the table, so destroy() hasn't dropped the reference
+	 * connect() gave out and this one can't be the first. */
+	session_retain(*session);
+
+	return *session;
+}
+
+void cq_irc_session_release(struct cq_irc_session *session)
+{
+	session_release(session);
+}
+
+void cq_irc_service_for_each_session(
+	struct cq_irc_service *service,
+	void (*func)(struct cq_irc_session *session, void *data),
+	void *data)
+{
+	std::lock_guard<std::mutex> lock(service->sessions_mutex);
+
+	for (cq_irc_session *session : service->sessions)
+		func(session, data);
+}
+
+struct cq_irc_service *cq_irc_service_create()
+{
+	return new cq_irc_service;
+}
 
+int cq_irc_service_start_workers(struct cq_irc_service *service, unsigned threads, size_t max_queued, enum cq_irc_queue_policy policy)
+{
+	cq_irc::worker_pool *expected = nullptr;
 
+	if (threads == 0 || service->workers.load())
+		return -1;
 
-	void thread_parse(cq_irc_session *session, mutable_buffer buf)
-	{
+	cq_irc::worker_pool *workers = new cq_irc::worker_pool(threads, max_queued, policy);
 
-		/* Flexical analyzer */
-		yyscan_t scanner;
-		YY_BUFFER_STATE state;
+	if (!service->workers.compare_exchange_strong(expected, workers)) {
+		delete workers;
+		return -1;
+	}
 
-		if (yylex_init_extra(session, &scanner) != 0) {
-			printf("Failed to initialize Flexical Analyzer.\n");
-			return;
-		}
+	return 0;
+}
 
-		state = yy_scan_buffer(buffer_cast<char*>(buf), buffer_size(buf), scanner);
+void cq_irc_service_worker_stats(struct cq_irc_service *service, struct cq_irc_worker_stats *stats)
+{
+	cq_irc::worker_pool *workers = service->workers.load();
 
-		if (!state) {
-			printf("Failed to initialize Flexical state.\n");
-			goto fail0;
-		}
+	if (workers)
+		workers->stats(*stats);
+	else
+		memset(stats, 0, sizeof(*stats));
+}
 
-		{
-			int result = yylex(scanner);
+void cq_irc_service_destroy(struct cq_irc_service* service)
+{
+	delete service;
+}
 
-			if (result > 0) { /* Skipped */
-				printf("Missing callback, skipped parsing stage.\n");
-			}
-			if (result < 0) { /* Error */
-				printf("Failed to parse message!\n");
-			}
-		}
+const char *cq_irc_service_intern(struct cq_irc_service *service, const char *str, size_t size)
+{
+	return service->strings.intern(str, size);
+}
 
-		delete[] buffer_cast<char*>(buf);
-		yy_delete_buffer(state, scanner);
-	
-	fail0:
-		yylex_destroy(scanner);
+void cq_irc_service_attach(struct cq_irc_service* service)
+{
+	run_service(service);
+}
+
+int cq_irc_service_attach_cpus(struct cq_irc_service* service, const int *cpus, size_t count)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+
+	for (size_t i = 0; i < count; ++i) {
+		if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+			return -1;
+
+		CPU_SET(cpus[i], &set);
 	}
 
-	void on_read(
-	  const error_code& error,
-	  std::size_t msg_size,
-	  cq_irc_session *session)
-	{
-		auto handler = std::bind(on_read, _1, _2, session);
+	if (!count || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		printf("Failed to pin service thread.\n");
+		return -1;
+	}
 
-		/* Extra two bytes are for Flex so we don't require a copy buffer. */
-		int buf_size = msg_size + 2;
+	run_service(service);
+
+	return 0;
+}
+
+void cq_irc_service_poll(struct cq_irc_service* service)
+{
+	clear_wakeups(service);
+	service->service.poll();
+}
+
+int cq_irc_service_get_fd(struct cq_irc_service *service)
+{
+	std::call_once(service->fd_created, [service]() {
+		epoll_event event = {};
+		int poll_fd = epoll_create1(EPOLL_CLOEXEC);
+		int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		event.events = EPOLLIN;
+
+		if (poll_fd < 0 || wake_fd < 0 ||
+		    epoll_ctl(poll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+			printf("Failed to create the service descriptor.\n");
+
+			if (poll_fd >= 0)
+				close(poll_fd);
+			if (wake_fd >= 0)
+				close(wake_fd);
 
-		if (error == error::eof ) {
-			session->callbacks.signal_disconnect(session);
-			return;
-		} else if (error == error::operation_aborted) {
-			if (!session->socket.is_open()) {
-				session->callbacks.signal_disconnect(session);
-				printf("Connection closed by client.\n");
-				return;
-			}
-		} else if (error) {
-			printf("Reading Error: %s\n", error.message().c_str());
 			return;
 		}
 
-		mutable_buffer buf(new char[buf_size](), buf_size);
+		service->poll_fd = poll_fd;
+		service->wake_fd = wake_fd;
+		service->external.store(true, std::memory_order_release);
+	});
+
+	return service->poll_fd;
+}
+
+int cq_irc_service_poll_budget(struct cq_irc_service* service, unsigned max_handlers, unsigned max_microseconds)
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point deadline = clock::now() + std::chrono::microseconds(max_microseconds);
+	io_service &io = service->service;
+
+	/* poll_one() stops the io_service whenever it finds no work at all,
+	 * as before the first connect; a frame loop keeps calling. */
+	if (io.stopped())
+		io.restart();
 
-		buffer_copy(buf, session->input.data(), msg_size);
-		session->input.consume(msg_size);
+	clear_wakeups(service);
 
-		async_read_until(
-			session->socket, session->input,
-			"\r\n",	handler);
+	for (unsigned handlers = 0; ; ) {
+		if (!io.poll_one())
+			return 0;
 
-		auto parse_work = std::bind(thread_parse, session, buf);
+		bool spent = (max_handlers && ++handlers >= max_handlers) ||
+			(max_microseconds && clock::now() >= deadline);
 
-		session->service->service.post(parse_work);
+		/* asio can't say whether anything is ready without running it,
+		 * and the handler just run may have been the last. */
+		if (spent)
+			return io.poll_one() ? 1 : 0;
 	}
+}
 
-	void on_connect(
-		const error_code& error,
-		ip::tcp::resolver::iterator iterator,
-		cq_irc_session *session)
-	{
-		auto handler = std::bind(on_read, _1, _2, session);
+void cq_irc_service_set_low_latency(struct cq_irc_service* service, int enable, unsigned busy_poll_us, unsigned spin_us)
+{
+	service->low_latency = enable != 0;
+	service->busy_poll_us = enable ? busy_poll_us : 0;
+	service->spin_us = enable ? spin_us : 0;
+}
 
-		if (error) {
-			printf("Connection Error: %s\n", error.message().c_str());
-			return;
-		}
+void cq_irc_service_stop(struct cq_irc_service* service)
+{
+	service->service.stop();
+}
 
-		session->callbacks.signal_connect(session);
+/* Fetches associated service from the session */
+struct cq_irc_service *cq_irc_session_get_service(struct cq_irc_session* session)
+{
+	return session->service;
+}
 
-		async_read_until(
-			session->socket, session->input,
-			"\r\n",	handler);
-	}
+void cq_irc_session_get_isupport(struct cq_irc_session *session, struct cq_irc_isupport *isupport)
+{
+	session->isupport.snapshot(*isupport);
+}
 
-	void on_resolve(
-		const error_code& error, 
-		ip::tcp::resolver::iterator iterator,
-		cq_irc_session *session)
-	{
-		auto handler = std::bind(on_connect, _1, _2, session);
+int cq_irc_session_is_channel(struct cq_irc_session *session, const char *name)
+{
+	return session->isupport.is_channel(name);
+}
 
-		if (error) {
-			printf("Resolver error: %s\n", error.message().c_str());
-			return;
-		}
+enum cq_irc_chanmode_type cq_irc_session_chanmode_type(struct cq_irc_session *session, char mode)
+{
+	return static_cast<cq_irc_chanmode_type>(
+		session->isupport.chanmode[static_cast<unsigned char>(mode)].load(std::memory_order_relaxed));
+}
 
-		async_connect(
-			session->socket, iterator, handler);
-	}
+char cq_irc_session_prefix_mode(struct cq_irc_session *session, char symbol)
+{
+	return session->isupport.prefix_by_symbol[static_cast<unsigned char>(symbol)].load(std::memory_order_relaxed);
+}
 
-	void on_write(const error_code& error, std::size_t bytes_written, char* buffer)
-	{
-		if (error) {
-			printf("Write error: %s\n", error.message().c_str());
-		}
+int cq_irc_session_interest_add(struct cq_irc_session *session, const char *command)
+{
+	if (!command || !*command || strchr(command, ' '))
+		return -1;
 
-		delete [] buffer;
-	}
+	update_interest(session, [command](cq_irc::interest &set) {
+		set.add_command(command, strlen(command));
+	});
+
+	return 0;
 }
 
-extern "C" {
+int cq_irc_session_interest_add_target(struct cq_irc_session *session, const char *target)
+{
+	if (!target || !*target || strchr(target, ' '))
+		return -1;
 
-cq_irc_session *cq_irc_session_connect(
-	struct cq_irc_service* service,
-	const char* host, 
-	const char *port,
-	struct cq_irc_callbacks* callbacks)
+	update_interest(session, [target](cq_irc::interest &set) {
+		set.add_target(target, strlen(target));
+	});
+
+	return 0;
+}
+
+void cq_irc_session_interest_clear(struct cq_irc_session *session)
+{
+	std::atomic_store(&session->interest, std::shared_ptr<const cq_irc::interest>());
+}
+
+cq_irc_handle cq_irc_service_subscribe(struct cq_irc_service *service, const struct cq_irc_filter *filter, cq_irc_event_handler handler, void *data)
 {
-	cq_irc_session *session = new cq_irc_session(service);
-	ip::tcp::resolver::query query(host, port);
-	auto handler = std::bind(on_resolve, _1, _2, session);
+	std::shared_ptr<cq_irc::subscription> sub = std::make_shared<cq_irc::subscription>();
 
-	session->resolver.async_resolve(
-		query, handler);
+	if (!handler || !cq_irc::compile_filter(*filter, *sub))
+		return 0;
 
-	session->callbacks = *callbacks;
+	sub->handler = handler;
+	sub->data = data;
 
-	return session;
+	std::lock_guard<std::mutex> lock(service->events_mutex);
+	cq_irc_handle handle = service->subscriptions.insert(sub);
+
+	rebuild_events(service);
+
+	return handle;
 }
 
-void cq_irc_session_disconnect(struct cq_irc_session *session)
+int cq_irc_service_unsubscribe(struct cq_irc_service *service, cq_irc_handle subscription)
 {
-	session->socket.shutdown(ip::tcp::socket::shutdown_both);
-	session->socket.close();
+	std::lock_guard<std::mutex> lock(service->events_mutex);
+
+	if (!service->subscriptions.remove(subscription))
+		return -1;
+
+	rebuild_events(service);
+
+	return 0;
 }
 
-void cq_irc_session_destroy(struct cq_irc_session *session)
+void cq_irc_session_set_budget(struct cq_irc_session *session, size_t max_bytes)
 {
-	delete session;
+	session->budget.store(max_bytes);
 }
 
-struct cq_irc_service *cq_irc_service_create()
+void cq_irc_service_set_budget(struct cq_irc_service *service, size_t max_bytes)
 {
-	return new cq_irc_service;
+	service->budget.store(max_bytes);
 }
 
-void cq_irc_service_destroy(struct cq_irc_service* service)
+void cq_irc_session_set_max_line(struct cq_irc_session *session, size_t max_size, enum cq_irc_overflow_policy policy)
 {
-	delete service;
+	session->max_line.store(max_size);
+	session->overflow_policy.store(policy);
 }
 
-void cq_irc_service_attach(struct cq_irc_service* service)
+void cq_irc_session_auto_pong(struct cq_irc_session *session, int enable)
 {
-	service->service.run();
+	session->auto_pong.store(enable != 0);
 }
 
-void cq_irc_service_poll(struct cq_irc_service* service)
+void cq_irc_session_set_raw(struct cq_irc_session *session, int raw)
 {
-	service->service.poll();
+	session->raw.store(raw != 0);
 }
 
-void cq_irc_service_stop(struct cq_irc_service* service)
+struct cq_irc_message *cq_irc_message_retain(const struct cq_irc_message *message)
 {
-	service->service.stop();
+	cq_irc_message *copy = new cq_irc_message(*message);
+
+	if (copy->chunk)
+		cq_irc::chunk_retain(copy->chunk);
+
+	return copy;
 }
 
-/* Fetches associated service from the session */
-struct cq_irc_service *cq_irc_session_get_service(struct cq_irc_session* session)
+void cq_irc_message_release(struct cq_irc_message *message)
 {
-	return session->service;
+	if (!message)
+		return;
+
+	if (message->chunk)
+		cq_irc::chunk_release(message->chunk);
+
+	delete message;
+}
+
+void cq_irc_session_track_state(struct cq_irc_session *session)
+{
+	cq_irc::state_tracker *expected = nullptr;
+	cq_irc::state_tracker *state = new cq_irc::state_tracker(session->isupport, session->service->strings);
+
+	if (!session->state.compare_exchange_strong(expected, state))
+		delete state;
+}
+
+/* The queries below treat a session without tracking as knowing of no
+ * channels at all. */
+int cq_irc_session_is_member(struct cq_irc_session *session, const char *channel, const char *nick)
+{
+	cq_irc::state_tracker *state = session->state.load();
+
+	return state && state->is_member(channel, nick);
+}
+
+int cq_irc_session_member_prefixes(struct cq_irc_session *session, const char *channel, const char *nick, char *out, size_t size)
+{
+	cq_irc::state_tracker *state = session->state.load();
+
+	return state ? state->member_prefixes(channel, nick, out, size) : -1;
+}
+
+int cq_irc_session_channel_topic(struct cq_irc_session *session, const char *channel, char *out, size_t size)
+{
+	cq_irc::state_tracker *state = session->state.load();
+
+	return state ? state->topic(channel, out, size) : -1;
+}
+
+size_t cq_irc_session_member_count(struct cq_irc_session *session, const char *channel)
+{
+	cq_irc::state_tracker *state = session->state.load();
+
+	return state ? state->member_count(channel) : 0;
+}
+
+void cq_irc_session_foreach_member(
+	struct cq_irc_session *session,
+	const char *channel,
+	void (*func)(void *data, const char *nick, const char *prefixes),
+	void *data)
+{
+	cq_irc::state_tracker *state = session->state.load();
+
+	if (state)
+		state->for_each_member(channel, func, data);
+}
+
+void cq_irc_casefold(enum cq_irc_casemapping casemapping, const char *in, size_t size, char *out)
+{
+	cq_irc::casefold(in, size, out, casemapping);
+}
+
+int cq_irc_casecmp(enum cq_irc_casemapping casemapping, const char *a, const char *b)
+{
+	return cq_irc::casecmp(a, strlen(a), b, strlen(b), casemapping);
+}
+
+uint32_t cq_irc_casehash(enum cq_irc_casemapping casemapping, const char *str, size_t size)
+{
+	return cq_irc::casehash(str, size, casemapping);
+}
+
+void cq_irc_session_casefold(struct cq_irc_session *session, const char *in, size_t size, char *out)
+{
+	cq_irc::casefold(in, size, out, session->isupport.casemapping);
+}
+
+int cq_irc_session_casecmp(struct cq_irc_session *session, const char *a, const char *b)
+{
+	return cq_irc::casecmp(a, strlen(a), b, strlen(b), session->isupport.casemapping);
+}
+
+uint32_t cq_irc_session_casehash(struct cq_irc_session *session, const char *str, size_t size)
+{
+	return cq_irc::casehash(str, size, session->isupport.casemapping);
 }
 
 void cq_irc_session_write(struct cq_irc_session *session, const char* msg, const int size)
 {
 	if (!msg ||	!size) return;
 
-	char *_buffer = new char[size + 2];
-	memcpy(_buffer, msg, size);
-	memcpy(_buffer + size, "\r\n", 2);
+	write_line(session, cq_irc::arg(msg, size));
+}
+
+int cq_irc_session_send(
+	struct cq_irc_session *session,
+	const char *command,
+	const char **params,
+	int nparams,
+	const char *trailing)
+{
+	cq_irc::piece pieces[14];
+	cq_irc::piece cmd = cq_irc::arg(command);
+	cq_irc::piece tail = cq_irc::arg(trailing);
+	std::size_t size = cmd.size + 2;
+
+	if (nparams < 0 || nparams > 14 || !valid_middle(cmd))
+		return -1;
+
+	for (int i = 0; i < nparams; ++i) {
+		pieces[i] = cq_irc::arg(params[i]);
+
+		if (!valid_middle(pieces[i]))
+			return -1;
+
+		size += pieces[i].size + 1;
+	}
+
+	if (trailing) {
+		if (!valid_trailing(tail))
+			return -1;
+
+		size += tail.size + 2;
+	}
+
+	cq_irc::output_node *node = cq_irc::output_create(size);
+	char *out = node->data;
+
+	out = cq_irc::put_piece(out, cmd);
+
+	for (int i = 0; i < nparams; ++i) {
+		*out++ = ' ';
+		out = cq_irc::put_piece(out, pieces[i]);
+	}
+
+	if (trailing) {
+		out = cq_irc::put_piece(out, " :");
+		out = cq_irc::put_piece(out, tail);
+	}
+
+	cq_irc::put_piece(out, "\r\n");
 
-	async_write(
-		session->socket,
-		buffer(_buffer, size + 2),
-		session->output_strand.wrap(std::bind(on_write, std::placeholders::_1, std::placeholders::_2, _buffer)));
+	send_output(session, node);
+
+	return 0;
 }
 
 void cq_irc_session_write_sync(struct cq_irc_session *session, const char* msg, const int size)
@@ -217,33 +2047,86 @@ void cq_irc_session_write_sync(struct cq_irc_session *session, const char* msg,
 	delete _buffer;
 }
 
-void cq_irc_session_pong(struct cq_irc_session* session, const char *ping)
+int cq_irc_session_pong(struct cq_irc_session* session, const char *ping)
+{
+	cq_irc::piece token = cq_irc::arg(ping);
+
+	if (!valid_trailing(token))
+		return -1;
+
+	answer_ping(session, token);
+
+	return 0;
+}
+
+struct cq_irc_plugin *cq_irc_plugin_load(const char *path)
+{
+	std::shared_ptr<const cq_irc_callbacks> callbacks = cq_irc::plugin_open(path);
+
+	if (!callbacks)
+		return nullptr;
+
+	return new cq_irc_plugin { callbacks };
+}
+
+void cq_irc_plugin_unload(struct cq_irc_plugin *plugin)
+{
+	delete plugin;
+}
+
+void cq_irc_session_use_plugin(struct cq_irc_session *session, struct cq_irc_plugin *plugin)
+{
+	std::atomic_store(&session->callbacks, plugin->callbacks);
+}
+
+void cq_irc_session_set_callbacks(struct cq_irc_session *session, const struct cq_irc_callbacks *callbacks)
 {
-	fmt::Writer out;
-	out.Format("PONG {0}", ping);
+	std::atomic_store(&session->callbacks, share_callbacks(session->service, *callbacks));
+}
+
+struct cq_irc_callbacks *cq_irc_callbacks_from_library(const char* library_name)
+{
+	cq_irc_plugin *plugin = cq_irc_plugin_load(library_name);
+
+	if (!plugin)
+		return nullptr;
 
-	cq_irc_session_write(session, out.data(), out.size());
+	return const_cast<cq_irc_callbacks*>(plugin->callbacks.get());
 }
 
-void cq_irc_session_privmsg(struct cq_irc_session* session, const char* channel, const char* message)
+int cq_irc_session_privmsg(struct cq_irc_session* session, const char* channel, const char* message)
 {
-	fmt::Writer out;
+	return write_split(session, "PRIVMSG", channel, message);
+}
+
+int cq_irc_session_notice(struct cq_irc_session* session, const char* target, const char* message)
+{
+	return write_split(session, "NOTICE", target, message);
+}
 
-	out.Format("PRIVMSG {0} :{1}", channel, message);
+int cq_irc_session_privmsg_multi(struct cq_irc_session* session, const char** targets, int ntargets, const char* message)
+{
+	return write_fanout(session, "PRIVMSG", targets, ntargets, message);
+}
 
-	cq_irc_session_write(session, out.data(), out.size());
+int cq_irc_session_notice_multi(struct cq_irc_session* session, const char** targets, int ntargets, const char* message)
+{
+	return write_fanout(session, "NOTICE", targets, ntargets, message);
 }
 
-void cq_irc_session_quit(struct cq_irc_session* session, const char *message)
+int cq_irc_session_quit(struct cq_irc_session* session, const char *message)
 {
-	fmt::Writer out;
+	cq_irc::piece text = cq_irc::arg(message);
+
+	if (!valid_trailing(text))
+		return -1;
 
 	if (message)
-		out.Format("QUIT :{0}", message);
+		write_line(session, "QUIT :", text);
 	else
-		out.Format("QUIT");
+		write_line(session, "QUIT");
 
-	cq_irc_session_write(session, out.data(), out.size());
+	return 0;
 }
 
 }
\ No newline at end of file
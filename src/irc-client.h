@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -7,12 +8,17 @@ extern "C" {
 
 struct cq_irc_service;
 struct cq_irc_session;
+struct cq_irc_chunk;
 struct cq_irc_plugin;
 
+/* Interned by the service for the messages it hands out: equal strings
+ * have equal pointers for as long as the messages holding them live,
+ * retained copies included. The service lets go of a string once no
+ * message or tracked state refers to it. */
 struct cq_irc_prefix {
-	char *host;
-	char *user;
-	char *source;
+	const char *host;
+	const char *user;
+	const char *source;
 };
 
 struct cq_irc_params {
@@ -20,10 +26,151 @@ struct cq_irc_params {
 	uint8_t length;
 };
 
+enum cq_irc_command {
+	CQ_IRC_COMMAND_UNKNOWN,
+	CQ_IRC_COMMAND_NUMERIC, /* see cq_irc_message.numeric */
+	CQ_IRC_COMMAND_PRIVMSG,
+	CQ_IRC_COMMAND_NOTICE,
+	CQ_IRC_COMMAND_PING,
+	CQ_IRC_COMMAND_PONG,
+	CQ_IRC_COMMAND_ERROR,
+	CQ_IRC_COMMAND_JOIN,
+	CQ_IRC_COMMAND_PART,
+	CQ_IRC_COMMAND_QUIT,
+	CQ_IRC_COMMAND_NICK,
+	CQ_IRC_COMMAND_MODE,
+	CQ_IRC_COMMAND_KICK,
+	CQ_IRC_COMMAND_TOPIC,
+	CQ_IRC_COMMAND_INVITE,
+	CQ_IRC_COMMAND_COUNT
+};
+
 struct cq_irc_message {
 	struct cq_irc_prefix prefix;
 	struct cq_irc_params params;
 	char *trailing;
+	const char *target; /* interned first parameter if it names a channel, else NULL */
+	uint16_t command;   /* enum cq_irc_command */
+	uint16_t numeric;   /* 001-999 when command is CQ_IRC_COMMAND_NUMERIC */
+	struct cq_irc_chunk *chunk; /* receive buffer the strings live in */
+};
+
+/* Payloads for the typed signals. They point into the message they
+ * were decoded from and share its lifetime. Fields the server left out
+ * are NULL. */
+struct cq_irc_join {
+	const char *channel;
+	const char *account;  /* extended-join only; "*" if not logged in */
+	const char *realname; /* extended-join only */
+};
+
+struct cq_irc_part {
+	const char *channel;
+	const char *reason;
+};
+
+struct cq_irc_quit {
+	const char *reason;
+};
+
+struct cq_irc_nick {
+	const char *old_nick;
+	const char *new_nick;
+};
+
+struct cq_irc_kick {
+	const char *channel;
+	const char *target;
+	const char *reason;
+};
+
+/* From TOPIC, or from RPL_TOPIC (332) when joining. */
+struct cq_irc_topic {
+	const char *channel;
+	const char *topic;
+};
+
+/* One letter of a MODE line, with its argument if CHANMODES/PREFIX say
+ * it takes one. */
+struct cq_irc_mode_change {
+	char sign; /* '+' or '-' */
+	char mode;
+	const char *arg;
+};
+
+struct cq_irc_mode {
+	const char *target;
+	const struct cq_irc_mode_change *changes;
+	size_t count;
+};
+
+/* RPL_NAMREPLY (353) entries; nicks are interned. */
+struct cq_irc_name {
+	const char *nick;
+	char prefixes[8]; /* PREFIX symbols, highest first */
+};
+
+struct cq_irc_names {
+	const char *channel;
+	const struct cq_irc_name *names;
+	size_t count;
+};
+
+enum cq_irc_casemapping {
+	CQ_IRC_CASEMAPPING_RFC1459,
+	CQ_IRC_CASEMAPPING_STRICT_RFC1459,
+	CQ_IRC_CASEMAPPING_ASCII
+};
+
+/* CHANMODES groups A to D, plus the modes listed in PREFIX. */
+enum cq_irc_chanmode_type {
+	CQ_IRC_CHANMODE_NONE,
+	CQ_IRC_CHANMODE_LIST,     /* A: list mode, always takes a parameter */
+	CQ_IRC_CHANMODE_SETTING,  /* B: always takes a parameter */
+	CQ_IRC_CHANMODE_SET_ONLY, /* C: takes a parameter only when set */
+	CQ_IRC_CHANMODE_FLAG,     /* D: never takes a parameter */
+	CQ_IRC_CHANMODE_PREFIX    /* grants a membership prefix, takes a nick */
+};
+
+/* What the server advertised in RPL_ISUPPORT (005), with RFC 1459
+ * defaults for anything it didn't. UINT_MAX means no limit; a TARGMAX
+ * of 0 means the server didn't give one and maxtargets applies. */
+struct cq_irc_isupport {
+	enum cq_irc_casemapping casemapping;
+	char prefix_modes[16];
+	char prefix_symbols[16];
+	char chantypes[16];
+	char chanmodes[4][64];
+	char network[64];
+	unsigned modes;
+	unsigned nicklen;
+	unsigned channellen;
+	unsigned topiclen;
+	unsigned kicklen;
+	unsigned maxtargets;
+	unsigned targmax_privmsg;
+	unsigned targmax_notice;
+	unsigned linelen;
+};
+
+/* A line as it arrived, without its CR/LF. Not NUL-terminated. */
+struct cq_irc_line {
+	const char *data;
+	size_t size;
+};
+
+/* Struct-of-arrays view of a batch of messages; index i of every array
+ * describes messages[i]. targets are first parameters (or the trailing
+ * argument when there are none) and are NULL when absent. names are
+ * the command text where the lexer kept it, NULL otherwise. */
+struct cq_irc_batch {
+	const uint16_t *commands;  /* enum cq_irc_command */
+	const uint16_t *numerics;
+	const char *const *names;
+	const char *const *targets;
+	const size_t *target_sizes;
+	const char *const *trailing;
+	const size_t *trailing_sizes;
 };
 
 typedef void (*irc_signal_t)(struct cq_irc_session*, struct cq_irc_message*);
@@ -37,25 +184,325 @@ struct cq_irc_callbacks {
 	irc_signal_t signal_error;
 	void(*signal_unknown)(struct cq_irc_session*, const char* command, struct cq_irc_message*);
 	void(*signal_disconnect)(struct cq_irc_session*);
+
+	/* Typed signals. A command with one of these set goes to it instead
+	 * of signal_unknown. signal_numeric gets any numeric without a more
+	 * specific signal; 004 (RPL_MYINFO) is signal_welcome's when that is
+	 * set. */
+	void(*signal_join)(struct cq_irc_session*, const struct cq_irc_join*, struct cq_irc_message*);
+	void(*signal_part)(struct cq_irc_session*, const struct cq_irc_part*, struct cq_irc_message*);
+	void(*signal_quit)(struct cq_irc_session*, const struct cq_irc_quit*, struct cq_irc_message*);
+	void(*signal_nick)(struct cq_irc_session*, const struct cq_irc_nick*, struct cq_irc_message*);
+	void(*signal_mode)(struct cq_irc_session*, const struct cq_irc_mode*, struct cq_irc_message*);
+	void(*signal_kick)(struct cq_irc_session*, const struct cq_irc_kick*, struct cq_irc_message*);
+	void(*signal_topic)(struct cq_irc_session*, const struct cq_irc_topic*, struct cq_irc_message*);
+	void(*signal_names)(struct cq_irc_session*, const struct cq_irc_names*, struct cq_irc_message*);
+	void(*signal_numeric)(struct cq_irc_session*, unsigned numeric, struct cq_irc_message*);
+
+	/* When set, every message parsed from one read is delivered here in
+	 * a single call instead of through the per-message signals above.
+	 * The messages are freed once it returns. */
+	void(*signal_batch)(struct cq_irc_session*, const struct cq_irc_message *messages, size_t count, const struct cq_irc_batch *view);
+
+	/* Raw mode: every complete line from one read, pointing into the
+	 * receive buffer and valid only until the callback returns. */
+	void(*signal_raw)(struct cq_irc_session*, const struct cq_irc_line *lines, size_t count);
 };
 
 
 void cq_irc_service_attach(struct cq_irc_service*);
+
+/* Low-latency mode for sessions connected afterwards: TCP_NODELAY on
+ * every socket, TCP_QUICKACK re-armed after every read and, if
+ * busy_poll_us is nonzero, SO_BUSY_POLL for that many microseconds
+ * (raising it past net.core.busy_read needs CAP_NET_ADMIN). With spin_us
+ * nonzero, attach() keeps polling for that long after the last handler
+ * before it sleeps in the reactor, trading a busy core for wakeups. */
+void cq_irc_service_set_low_latency(struct cq_irc_service*, int enable, unsigned busy_poll_us, unsigned spin_us);
+
+/* As cq_irc_service_attach(), but first pins the calling thread to the
+ * given CPUs. Receive buffers are allocated, and first touched, by the
+ * I/O thread that reads into them, so with one pinned thread per node
+ * each read lands in memory local to the thread handling it. Returns
+ * -1 without running if the thread could not be pinned. */
+int cq_irc_service_attach_cpus(struct cq_irc_service*, const int *cpus, size_t count);
 void cq_irc_service_poll(struct cq_irc_service*);
+
+/* As cq_irc_service_poll(), but returns once max_handlers handlers have
+ * run or max_microseconds have passed, whichever comes first (0 for no
+ * limit on either). A handler is one unit of work, such as the lines of
+ * one read; the time limit is checked between handlers, never during
+ * one. Returns 0 once nothing is ready. On reaching the budget it runs
+ * one more handler, if one is ready, to tell whether the queue is empty:
+ * it returns 1 only if that handler ran, so more may be pending.
+ *
+ * With no session and nothing queued the service runs out of work and
+ * stops; a stopped service is restarted at the start of each call, so a
+ * frame loop can keep calling this before the first connect and after
+ * the last session is destroyed. That includes a service stopped with
+ * cq_irc_service_stop(). */
+int cq_irc_service_poll_budget(struct cq_irc_service*, unsigned max_handlers, unsigned max_microseconds);
 void cq_irc_service_stop(struct cq_irc_service*);
+
+/* A descriptor to hand to an external event loop instead of calling
+ * attach(): it turns readable whenever the service may have handlers to
+ * run, and cq_irc_service_poll() or cq_irc_service_poll_budget() clears
+ * it before running them. Only sessions connected after the first call
+ * are watched. The service owns the descriptor; returns -1 if it could
+ * not be created. */
+int cq_irc_service_get_fd(struct cq_irc_service*);
 struct cq_irc_service *cq_irc_service_create();
 void cq_irc_service_destroy(struct cq_irc_service*);
 
+/* What submitting callback work to a full worker pool does: stop
+ * reading from the session until a job finishes (the I/O thread itself
+ * never waits, and the pool may run over by one job per session), drop
+ * the work (its lines are neither delivered nor learned from), or run
+ * it on the I/O thread as if there were no pool. */
+enum cq_irc_queue_policy {
+	CQ_IRC_QUEUE_BLOCK,
+	CQ_IRC_QUEUE_DROP,
+	CQ_IRC_QUEUE_INLINE
+};
+
+struct cq_irc_worker_stats {
+	size_t depth;      /* jobs waiting now */
+	size_t max_depth;  /* most ever waiting at once */
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t inlined;
+};
+
+/* Moves callbacks off the I/O threads onto a pool of threads of their
+ * own, so slow handlers don't hold up reading. Each job is the lines of
+ * one read; a session's jobs run in order, one at a time. PING lines
+ * are still handled on the I/O thread as soon as they are read. At most
+ * max_queued jobs wait before policy applies. Can be started once per
+ * service; returns -1 otherwise or if threads is 0. */
+int cq_irc_service_start_workers(struct cq_irc_service *service, unsigned threads, size_t max_queued, enum cq_irc_queue_policy policy);
+
+/* All zero if workers were never started. */
+void cq_irc_service_worker_stats(struct cq_irc_service *service, struct cq_irc_worker_stats *stats);
+
+/* Returns the service's single copy of the string, so interned strings
+ * can be compared by pointer. Safe from any thread. The copy is kept
+ * until the service is destroyed. */
+const char *cq_irc_service_intern(struct cq_irc_service *service, const char *str, size_t size);
+
 struct cq_irc_service *cq_irc_session_get_service(struct cq_irc_session*);
 struct cq_irc_session *cq_irc_session_connect(struct cq_irc_service*, const char* host, const char *port, struct cq_irc_callbacks *);
+/* Safe from any thread. The socket is closed by the next handler the
+ * service runs, and signal_disconnect follows from there. */
 void cq_irc_session_disconnect(struct cq_irc_session*);
+/* Safe to call from any callback of the session, signal_disconnect
+ * included. The session stops calling back at once; its memory goes once
+ * the handlers and jobs already queued for it, and the references
+ * handed out by cq_irc_session_from_handle(), have been let go of. Only
+ * the first call for a session does anything. */
 void cq_irc_session_destroy(struct cq_irc_session *session);
+
+/* A name for a session that is safe to hold past its destruction:
+ * cq_irc_session_from_handle() returns NULL for it from then on, even
+ * once its slot is reused. 0 is never a handle.
+ *
+ * A lookup takes the service's session lock and a reference to the
+ * session, which the caller gives back with cq_irc_session_release().
+ * Until then the pointer stays valid, and can be passed to any session
+ * call, even if another thread destroys the session meanwhile; what is
+ * sent once the session is destroyed is dropped. Destroying through it drops the
+ * reference cq_irc_session_connect() returned, so a program that
+ * destroys sessions by handle should reach them only by handle. */
+typedef uint64_t cq_irc_handle;
+
+cq_irc_handle cq_irc_session_handle(struct cq_irc_session *session);
+struct cq_irc_session *cq_irc_session_from_handle(struct cq_irc_service *service, cq_irc_handle handle);
+void cq_irc_session_release(struct cq_irc_session *session);
+
+/* Calls func for every session not yet destroyed, walking the service's
+ * packed session table, with the session lock held: func must not
+ * connect or destroy sessions. */
+void cq_irc_service_for_each_session(
+	struct cq_irc_service *service,
+	void (*func)(struct cq_irc_session *session, void *data),
+	void *data);
 void cq_irc_session_write(struct cq_irc_session *session, const char* message, const int size);
 void cq_irc_session_write_sync(struct cq_irc_session *session, const char* msg, const int size);
+
+/* Handler plugins: shared libraries exporting
+ *
+ *     const struct cq_irc_callbacks cq_irc_plugin_callbacks;
+ *
+ * with signal_connect and signal_disconnect set. A plugin calling back
+ * into the library needs the program to export its symbols (-rdynamic).
+ * cq_irc_plugin_load() returns NULL, with a message, if the library
+ * can't be opened or lacks the table. dlopen() hands back the library
+ * already loaded from a path instead of reading it again, so install
+ * each new build under a path of its own.
+ *
+ * cq_irc_session_use_plugin() switches a live session to a plugin's
+ * callbacks in one atomic store: the connection, its buffered input and
+ * its queued output are untouched. Parse jobs that have started finish
+ * with the table they started with; everything after goes to the new
+ * one. A library is closed once its handle is unloaded and no session
+ * or running handler still uses it, so the old build can be unloaded
+ * straight after the swap. */
+struct cq_irc_plugin *cq_irc_plugin_load(const char *path);
+void cq_irc_plugin_unload(struct cq_irc_plugin *plugin);
+struct cq_irc_session *cq_irc_session_connect_plugin(struct cq_irc_service *service, const char *host, const char *port, struct cq_irc_plugin *plugin);
+void cq_irc_session_use_plugin(struct cq_irc_session *session, struct cq_irc_plugin *plugin);
+
+/* The same swap to a plain callback table, which is copied. */
+void cq_irc_session_set_callbacks(struct cq_irc_session *session, const struct cq_irc_callbacks *callbacks);
+
+/* Loads a plugin that is never unloaded and returns a copy of its table,
+ * for cq_irc_session_connect(); NULL if it can't be loaded. */
 struct cq_irc_callbacks *cq_irc_callbacks_from_library(const char* library_name);
-void cq_irc_session_privmsg(struct cq_irc_session* session, const char* channel, const char* message);
-void cq_irc_session_pong(struct cq_irc_session*, const char* ping);
-void cq_irc_session_quit(struct cq_irc_session* session, const char *message);
+
+/* Copies out everything learned from 005 so far. */
+void cq_irc_session_get_isupport(struct cq_irc_session *session, struct cq_irc_isupport *isupport);
+
+/* Table lookups against the current 005 state; no string parsing. */
+int cq_irc_session_is_channel(struct cq_irc_session *session, const char *name);
+enum cq_irc_chanmode_type cq_irc_session_chanmode_type(struct cq_irc_session *session, char mode);
+char cq_irc_session_prefix_mode(struct cq_irc_session *session, char symbol);
+
+/* Nick and channel comparison under a CASEMAPPING. casefold writes size
+ * bytes to out (which may be in); casehash is equal for strings that
+ * casecmp calls equal. The session variants use whatever the server
+ * advertised, rfc1459 until it says otherwise. */
+void cq_irc_casefold(enum cq_irc_casemapping casemapping, const char *in, size_t size, char *out);
+int cq_irc_casecmp(enum cq_irc_casemapping casemapping, const char *a, const char *b);
+uint32_t cq_irc_casehash(enum cq_irc_casemapping casemapping, const char *str, size_t size);
+void cq_irc_session_casefold(struct cq_irc_session *session, const char *in, size_t size, char *out);
+int cq_irc_session_casecmp(struct cq_irc_session *session, const char *a, const char *b);
+uint32_t cq_irc_session_casehash(struct cq_irc_session *session, const char *str, size_t size);
+
+/* Messages handed to callbacks only live until the callback returns.
+ * retain returns a copy that stays valid until released; it shares the
+ * strings (and the receive buffer holding them) with the original, so
+ * only the struct itself is copied. Works on retained copies too. */
+struct cq_irc_message *cq_irc_message_retain(const struct cq_irc_message *message);
+void cq_irc_message_release(struct cq_irc_message *message);
+
+/* Parse and callback work holds on to the data it was read from. Once
+ * what a session's pending work holds (or, for the service budget,
+ * what all sessions' work holds) goes past max_bytes, the session stops
+ * reading until enough of that work has finished. 0, the default, is
+ * no limit. Data pinned by retained messages after their work is done
+ * isn't counted. */
+void cq_irc_session_set_budget(struct cq_irc_session *session, size_t max_bytes);
+void cq_irc_service_set_budget(struct cq_irc_service *service, size_t max_bytes);
+
+enum cq_irc_overflow_policy {
+	CQ_IRC_OVERFLOW_DROP,       /* discard the line and carry on */
+	CQ_IRC_OVERFLOW_DISCONNECT  /* close the connection */
+};
+
+/* Lines longer than max_size bytes, not counting the line break, are
+ * never delivered or buffered past the limit. The default is 16384
+ * with CQ_IRC_OVERFLOW_DROP; 0 removes the limit. */
+void cq_irc_session_set_max_line(struct cq_irc_session *session, size_t max_size, enum cq_irc_overflow_policy policy);
+
+/* Answers PINGs as soon as the reader sees them, ahead of any queued
+ * output and before the line is parsed or waits behind other work.
+ * signal_ping (or signal_raw) still gets the line afterwards, as a
+ * notification; it must not answer it again. */
+void cq_irc_session_auto_pong(struct cq_irc_session *session, int enable);
+
+/* In raw mode lines go to signal_raw exactly as received, in batches,
+ * with no lexing, interest filtering or bookkeeping: 005 and state
+ * tracking see nothing and, without auto-PONG, PING is the user's to
+ * answer. It can be switched on and off at any time; the change applies
+ * from the next read. Without signal_raw set the session keeps parsing. */
+void cq_irc_session_set_raw(struct cq_irc_session *session, int raw);
+
+/* Interest sets let a session drop most of what the server sends
+ * without parsing it. Once a command ("PRIVMSG", "353", ...) is added,
+ * lines carrying other commands are discarded by the reader after a
+ * look at the command token, before anything is copied or lexed. Once
+ * a target is added, the listed non-numeric commands also need it as
+ * their first parameter. Lines the library itself depends on (PING,
+ * 001, 005, our JOIN/NICK, and what state tracking needs) are still
+ * parsed, but only PING reaches a callback unless it is in the set.
+ * Safe to change from any thread; return -1 for empty or spaced names. */
+int cq_irc_session_interest_add(struct cq_irc_session *session, const char *command);
+int cq_irc_session_interest_add_target(struct cq_irc_session *session, const char *target);
+void cq_irc_session_interest_clear(struct cq_irc_session *session);
+
+/* The event bus: any number of handlers per service, each with a filter
+ * on the command ("PRIVMSG", "353", ...), the target (the first
+ * parameter, or for numerics the first after our nick, compared under
+ * the session's CASEMAPPING) and the sender (a nick!user@host mask with
+ * * and ?). NULL fields match anything. Filters are compiled into an
+ * index shared by all sessions of the service, so a message reaches
+ * the handlers that match it with a lookup rather than a check per
+ * handler.
+ *
+ * Handlers run wherever the session's lines are parsed (the I/O thread
+ * or a worker), before the session's own callbacks, in no particular
+ * order among themselves, and may not keep the message. command is the
+ * command text for commands without a cq_irc_command of their own and
+ * NULL otherwise. Lines the session's interest set drops and raw-mode
+ * lines never reach them.
+ *
+ * Subscribing returns a handle, or 0 if a field is empty or has spaces
+ * in it. Both calls are safe from any thread, handlers included; a
+ * handler can still be called by a line already being parsed when it
+ * is unsubscribed. */
+struct cq_irc_filter {
+	const char *command;
+	const char *target;
+	const char *sender;
+};
+
+typedef void (*cq_irc_event_handler)(struct cq_irc_session *session, const char *command, const struct cq_irc_message *message, void *data);
+
+cq_irc_handle cq_irc_service_subscribe(struct cq_irc_service *service, const struct cq_irc_filter *filter, cq_irc_event_handler handler, void *data);
+int cq_irc_service_unsubscribe(struct cq_irc_service *service, cq_irc_handle subscription);
+
+/* Turns on channel/member/topic tracking for the rest of the session.
+ * Call it before joining anything (signal_connect is a good place) so
+ * no JOIN or NAMES reply is missed. Names are compared under the
+ * server's CASEMAPPING. */
+void cq_irc_session_track_state(struct cq_irc_session *session);
+int cq_irc_session_is_member(struct cq_irc_session *session, const char *channel, const char *nick);
+
+/* Writes the member's prefix symbols (e.g. "@+"), highest first.
+ * Returns -1 if nick isn't known to be in channel. */
+int cq_irc_session_member_prefixes(struct cq_irc_session *session, const char *channel, const char *nick, char *out, size_t size);
+
+/* Copies the topic into out and returns its full length, or -1 if we
+ * aren't in the channel. */
+int cq_irc_session_channel_topic(struct cq_irc_session *session, const char *channel, char *out, size_t size);
+size_t cq_irc_session_member_count(struct cq_irc_session *session, const char *channel);
+
+/* func must not call back into the tracking functions. */
+void cq_irc_session_foreach_member(struct cq_irc_session *session, const char *channel, void (*func)(void *data, const char *nick, const char *prefixes), void *data);
+
+/* The functions below validate their arguments before queueing anything:
+ * middle parameters may not be empty, start with ':' or contain spaces,
+ * and no argument may contain CR, LF or NUL. They return 0 once the line
+ * is queued and -1 if it was rejected. trailing may be NULL. */
+int cq_irc_session_send(struct cq_irc_session *session, const char *command, const char **params, int nparams, const char *trailing);
+
+/* Messages longer than fit in one line once the server adds our prefix
+ * are split on word (or failing that, UTF-8 code point) boundaries and
+ * all parts are queued together. */
+int cq_irc_session_privmsg(struct cq_irc_session* session, const char* channel, const char* message);
+int cq_irc_session_notice(struct cq_irc_session* session, const char* target, const char* message);
+
+/* Sends the same message to every target, joining targets into
+ * comma-separated lists within the server's TARGMAX/MAXTARGETS and line
+ * length. Servers that advertise neither get one target per line. A
+ * target too long to share a line with the message gets the message
+ * split as cq_irc_session_privmsg() does; those lines come last, after
+ * every packed line. All lines are queued together, and if any target
+ * is rejected none are. */
+int cq_irc_session_privmsg_multi(struct cq_irc_session* session, const char** targets, int ntargets, const char* message);
+int cq_irc_session_notice_multi(struct cq_irc_session* session, const char** targets, int ntargets, const char* message);
+/* Goes out ahead of anything else queued. */
+int cq_irc_session_pong(struct cq_irc_session*, const char* ping);
+int cq_irc_session_quit(struct cq_irc_session* session, const char *message);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+/* Outgoing command lines are described as a sequence of pieces. String
+ * literals have their length fixed by the type system, so the size
+ * computation and copies for them fold into constants at compile time;
+ * only the runtime arguments need a strlen. There is no format string
+ * left to parse when a message is sent. */
+
+namespace cq_irc {
+
+struct piece {
+	const char *data;
+	std::size_t size;
+};
+
+inline piece arg(const char *str)
+{
+	return { str, str ? strlen(str) : 0 };
+}
+
+inline piece arg(const char *str, std::size_t size)
+{
+	return { str, size };
+}
+
+template <std::size_t N>
+constexpr std::size_t piece_size(const char (&)[N])
+{
+	return N - 1;
+}
+
+inline std::size_t piece_size(const piece &p)
+{
+	return p.size;
+}
+
+template <std::size_t N>
+inline char *put_piece(char *out, const char (&literal)[N])
+{
+	memcpy(out, literal, N - 1);
+	return out + N - 1;
+}
+
+inline char *put_piece(char *out, const piece &p)
+{
+	memcpy(out, p.data, p.size);
+	return out + p.size;
+}
+
+inline constexpr std::size_t line_size()
+{
+	return 0;
+}
+
+/* Length of the line described by the pieces, excluding CRLF. */
+template <typename Head, typename... Tail>
+inline std::size_t line_size(const Head &head, const Tail&... tail)
+{
+	return piece_size(head) + line_size(tail...);
+}
+
+inline char *build_line(char *out)
+{
+	return out;
+}
+
+/* Writes the pieces back to back into out, which must hold at least
+ * line_size() of them. Returns one past the last byte written. */
+template <typename Head, typename... Tail>
+inline char *build_line(char *out, const Head &head, const Tail&... tail)
+{
+	return build_line(put_piece(out, head), tail...);
+}
+
+}
@@ -0,0 +1,232 @@
+#include "irc-client-internal.h++"
+#include "irc-dispatch.h++"
+
+#include <cstring>
+#include <strings.h>
+
+namespace cq_irc {
+
+namespace {
+
+	struct command_name {
+		const char *name;
+		std::size_t size;
+		uint16_t command;
+	};
+
+	const command_name commands[] = {
+		{ "PRIVMSG", 7, CQ_IRC_COMMAND_PRIVMSG },
+		{ "NOTICE", 6, CQ_IRC_COMMAND_NOTICE },
+		{ "PING", 4, CQ_IRC_COMMAND_PING },
+		{ "PONG", 4, CQ_IRC_COMMAND_PONG },
+		{ "ERROR", 5, CQ_IRC_COMMAND_ERROR },
+		{ "JOIN", 4, CQ_IRC_COMMAND_JOIN },
+		{ "PART", 4, CQ_IRC_COMMAND_PART },
+		{ "QUIT", 4, CQ_IRC_COMMAND_QUIT },
+		{ "NICK", 4, CQ_IRC_COMMAND_NICK },
+		{ "MODE", 4, CQ_IRC_COMMAND_MODE },
+		{ "KICK", 4, CQ_IRC_COMMAND_KICK },
+		{ "TOPIC", 5, CQ_IRC_COMMAND_TOPIC },
+		{ "INVITE", 6, CQ_IRC_COMMAND_INVITE },
+	};
+
+	bool is_digit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	void copy_prefixes(char (&out)[8], const char *symbols, std::size_t size)
+	{
+		if (size >= sizeof(out))
+			size = sizeof(out) - 1;
+
+		memcpy(out, symbols, size);
+		out[size] = '\0';
+	}
+
+	void decode_names(cq_irc_parse *parse, const char *names, std::vector<cq_irc_name> &out)
+	{
+		isupport &caps = parse->session->isupport;
+
+		while (names && *names) {
+			while (*names == ' ')
+				++names;
+
+			const char *nick = names;
+
+			while (*nick && caps.prefix_by_symbol[static_cast<unsigned char>(*nick)].load(std::memory_order_relaxed))
+				++nick;
+
+			const char *end = nick + strcspn(nick, " !");
+
+			if (end != nick) {
+				cq_irc_name name;
+
+				name.nick = cq_irc_parse_pin(parse, nick, end - nick);
+				copy_prefixes(name.prefixes, names, nick - names);
+				out.push_back(name);
+			}
+
+			names = end + strcspn(end, " ");
+		}
+	}
+}
+
+void classify(const char *command, std::size_t size, uint16_t &id, uint16_t &numeric)
+{
+	numeric = 0;
+
+	if (size == 3 && is_digit(command[0]) && is_digit(command[1]) && is_digit(command[2])) {
+		id = CQ_IRC_COMMAND_NUMERIC;
+		numeric = (command[0] - '0') * 100 + (command[1] - '0') * 10 + (command[2] - '0');
+		return;
+	}
+
+	for (const command_name &entry : commands) {
+		if (entry.size == size && strncasecmp(entry.name, command, size) == 0) {
+			id = entry.command;
+			return;
+		}
+	}
+
+	id = CQ_IRC_COMMAND_UNKNOWN;
+}
+
+void classify(cq_irc_message *message, const char *command, std::size_t size)
+{
+	classify(command, size, message->command, message->numeric);
+}
+
+void decode_modes(isupport &caps, const cq_irc_message *message, std::vector<cq_irc_mode_change> &out)
+{
+	const char *modes = message_arg(message, 1);
+	bool channel = caps.is_channel(message_arg(message, 0));
+	char sign = '+';
+	int next = 2;
+
+	for (; modes && *modes; ++modes) {
+		unsigned char mode = *modes;
+
+		if (mode == '+' || mode == '-') {
+			sign = mode;
+			continue;
+		}
+
+		int type = channel ?
+			static_cast<uint16_t>(caps.chanmode[mode].load(std::memory_order_relaxed)) :
+			static_cast<uint16_t>(CQ_IRC_CHANMODE_FLAG);
+		bool takes_arg =
+			type == CQ_IRC_CHANMODE_LIST ||
+			type == CQ_IRC_CHANMODE_SETTING ||
+			type == CQ_IRC_CHANMODE_PREFIX ||
+			(type == CQ_IRC_CHANMODE_SET_ONLY && sign == '+');
+
+		out.push_back(cq_irc_mode_change { sign, static_cast<char>(mode), takes_arg ? message_arg(message, next++) : nullptr });
+	}
+}
+
+}
+
+using namespace cq_irc;
+
+bool cq_irc_session_has_typed(const cq_irc_callbacks &cb, const cq_irc_message *message)
+{
+	switch (message->command) {
+	case CQ_IRC_COMMAND_JOIN: return cb.signal_join;
+	case CQ_IRC_COMMAND_PART: return cb.signal_part;
+	case CQ_IRC_COMMAND_QUIT: return cb.signal_quit;
+	case CQ_IRC_COMMAND_NICK: return cb.signal_nick;
+	case CQ_IRC_COMMAND_MODE: return cb.signal_mode;
+	case CQ_IRC_COMMAND_KICK: return cb.signal_kick;
+	case CQ_IRC_COMMAND_TOPIC: return cb.signal_topic;
+	case CQ_IRC_COMMAND_NUMERIC:
+		return cb.signal_numeric ||
+			(message->numeric == 332 && cb.signal_topic) ||
+			(message->numeric == 353 && cb.signal_names);
+	default: return false;
+	}
+}
+
+bool cq_irc_session_dispatch(cq_irc_parse *parse, cq_irc_message *message)
+{
+	cq_irc_session *session = parse->session;
+	const cq_irc_callbacks &cb = *parse->callbacks;
+
+	if (!cq_irc_session_has_typed(cb, message))
+		return false;
+
+	switch (message->command) {
+	case CQ_IRC_COMMAND_JOIN: {
+		bool extended = message->params.length >= 2;
+		cq_irc_join join = {
+			message_arg(message, 0),
+			extended ? message->params.param[1] : nullptr,
+			extended ? message->trailing : nullptr
+		};
+
+		cb.signal_join(session, &join, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_PART: {
+		cq_irc_part part = { message_arg(message, 0), message_arg(message, 1) };
+
+		cb.signal_part(session, &part, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_QUIT: {
+		cq_irc_quit quit = { message_arg(message, 0) };
+
+		cb.signal_quit(session, &quit, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_NICK: {
+		cq_irc_nick nick = { message->prefix.source, message_arg(message, 0) };
+
+		cb.signal_nick(session, &nick, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_MODE: {
+		const std::vector<cq_irc_mode_change> &changes = cq_irc_parse_modes(parse, message);
+		cq_irc_mode mode = { message_arg(message, 0), changes.data(), changes.size() };
+
+		cb.signal_mode(session, &mode, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_KICK: {
+		cq_irc_kick kick = { message_arg(message, 0), message_arg(message, 1), message_arg(message, 2) };
+
+		cb.signal_kick(session, &kick, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_TOPIC: {
+		cq_irc_topic topic = { message_arg(message, 0), message_arg(message, 1) };
+
+		cb.signal_topic(session, &topic, message);
+		break;
+	}
+	case CQ_IRC_COMMAND_NUMERIC:
+		if (message->numeric == 332 && cb.signal_topic) {
+			/* me #channel :topic */
+			cq_irc_topic topic = { message_arg(message, 1), message_arg(message, 2) };
+
+			cb.signal_topic(session, &topic, message);
+		} else if (message->numeric == 353 && cb.signal_names) {
+			/* me [=*@] #channel :names */
+			std::vector<cq_irc_name> names;
+
+			decode_names(parse, message->trailing, names);
+
+			cq_irc_names reply = {
+				message->params.length ? message->params.param[message->params.length - 1] : nullptr,
+				names.data(), names.size()
+			};
+
+			cb.signal_names(session, &reply, message);
+		} else {
+			cb.signal_numeric(session, message->numeric, message);
+		}
+		break;
+	}
+
+	return true;
+}
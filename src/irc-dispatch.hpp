@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "irc-client.h"
+#include "irc-isupport.h++"
+
+namespace cq_irc {
+
+/* Sets message->command (and ->numeric) from the command token. */
+void classify(cq_irc_message *message, const char *command, std::size_t size);
+void classify(const char *command, std::size_t size, uint16_t &id, uint16_t &numeric);
+
+/* Parameter i, or the trailing argument if that's where the server put
+ * it; nullptr past the end. */
+inline const char *message_arg(const cq_irc_message *message, int i)
+{
+	if (i < message->params.length)
+		return message->params.param[i];
+	if (i == message->params.length)
+		return message->trailing;
+
+	return nullptr;
+}
+
+/* Splits a MODE line into changes. Channel modes take arguments as
+ * CHANMODES and PREFIX say; user modes are treated as flags. */
+void decode_modes(isupport &caps, const cq_irc_message *message, std::vector<cq_irc_mode_change> &out);
+
+}
@@ -0,0 +1,234 @@
+#include "irc-events.h++"
+#include "irc-casemap.h++"
+#include "irc-dispatch.h++"
+
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+
+namespace cq_irc {
+
+namespace {
+
+	bool valid_token(const char *token)
+	{
+		return *token && !strchr(token, ' ');
+	}
+
+	char fold(char c, int casemapping)
+	{
+		char out;
+
+		casefold(&c, 1, &out, casemapping);
+
+		return out;
+	}
+
+	/* Glob match with * and ?, backtracking only to the last star. */
+	bool glob(const std::string &pattern, const char *text, int casemapping)
+	{
+		const char *p = pattern.c_str();
+		const char *star = nullptr;
+		const char *resume = nullptr;
+
+		if (!text)
+			text = "";
+
+		while (*text) {
+			if (*p == '*') {
+				star = p++;
+				resume = text;
+			} else if (*p && (*p == '?' || fold(*p, casemapping) == fold(*text, casemapping))) {
+				++p;
+				++text;
+			} else if (star) {
+				p = star + 1;
+				text = ++resume;
+			} else {
+				return false;
+			}
+		}
+
+		while (*p == '*')
+			++p;
+
+		return !*p;
+	}
+
+	/* Nicks compare under the server's CASEMAPPING, idents and hosts as
+	 * plain ASCII. */
+	bool matches_sender(const subscription &sub, const cq_irc_message *message, int casemapping)
+	{
+		return (sub.nick.empty() || glob(sub.nick, message->prefix.source, casemapping)) &&
+			(sub.user.empty() || glob(sub.user, message->prefix.user, CQ_IRC_CASEMAPPING_ASCII)) &&
+			(sub.host.empty() || glob(sub.host, message->prefix.host, CQ_IRC_CASEMAPPING_ASCII));
+	}
+
+	/* The first parameter, or for numerics the first after our nick. */
+	const char *message_target(const cq_irc_message *message)
+	{
+		return message_arg(message, message->command == CQ_IRC_COMMAND_NUMERIC ? 1 : 0);
+	}
+
+	/* Target keys are hashed under rfc1459, which folds the most: names
+	 * equal under any mapping hash alike, and the session's own mapping
+	 * decides on a hit. */
+	const int key_casemapping = CQ_IRC_CASEMAPPING_RFC1459;
+}
+
+bool compile_filter(const cq_irc_filter &filter, subscription &out)
+{
+	out.any_command = !filter.command;
+	out.command = CQ_IRC_COMMAND_UNKNOWN;
+	out.numeric = 0;
+
+	if (filter.command) {
+		if (!valid_token(filter.command))
+			return false;
+
+		uint16_t id, numeric;
+		std::size_t size = strlen(filter.command);
+
+		classify(filter.command, size, id, numeric);
+		out.command = id;
+		out.numeric = numeric;
+
+		if (id == CQ_IRC_COMMAND_UNKNOWN)
+			out.name.assign(filter.command, size);
+	}
+
+	if (filter.target) {
+		if (!valid_token(filter.target))
+			return false;
+
+		out.target = filter.target;
+	}
+
+	if (filter.sender) {
+		std::string mask = filter.sender;
+		std::size_t bang = mask.find('!');
+		std::size_t at = mask.find('@', bang == std::string::npos ? 0 : bang);
+
+		out.nick = mask.substr(0, std::min(bang, at));
+
+		if (bang != std::string::npos)
+			out.user = mask.substr(bang + 1, at == std::string::npos ? std::string::npos : at - bang - 1);
+
+		if (at != std::string::npos)
+			out.host = mask.substr(at + 1);
+
+		for (std::string *part : { &out.nick, &out.user, &out.host }) {
+			if (*part == "*")
+				part->clear();
+		}
+	}
+
+	return true;
+}
+
+event_index::event_index(std::vector<std::shared_ptr<const subscription>> subscriptions)
+	: all(std::move(subscriptions)), commands(CQ_IRC_COMMAND_COUNT)
+{
+	for (const std::shared_ptr<const subscription> &sub : all) {
+		if (sub->any_command) {
+			add(any_command, sub.get());
+			has_any_command = true;
+		} else if (sub->command == CQ_IRC_COMMAND_NUMERIC) {
+			add(numerics[sub->numeric], sub.get());
+		} else if (sub->command != CQ_IRC_COMMAND_UNKNOWN) {
+			add(commands[sub->command], sub.get());
+		} else {
+			bucket *to = nullptr;
+
+			for (std::pair<std::string, bucket> &other : others) {
+				if (strcasecmp(other.first.c_str(), sub->name.c_str()) == 0)
+					to = &other.second;
+			}
+
+			if (!to) {
+				others.emplace_back(sub->name, bucket());
+				to = &others.back().second;
+			}
+
+			add(*to, sub.get());
+		}
+	}
+}
+
+void event_index::add(bucket &to, const subscription *sub)
+{
+	if (sub->target.empty())
+		to.any_target.push_back(sub);
+	else
+		to.targets[casehash(sub->target.data(), sub->target.size(), key_casemapping)].push_back(sub);
+}
+
+const event_index::bucket *event_index::find(uint16_t command, unsigned numeric, const char *name, std::size_t size) const
+{
+	if (command == CQ_IRC_COMMAND_NUMERIC) {
+		auto found = numerics.find(numeric);
+
+		return found == numerics.end() ? nullptr : &found->second;
+	}
+
+	if (command != CQ_IRC_COMMAND_UNKNOWN)
+		return command < commands.size() ? &commands[command] : nullptr;
+
+	if (!name)
+		return nullptr;
+
+	for (const std::pair<std::string, bucket> &other : others) {
+		if (other.first.size() == size && strncasecmp(other.first.data(), name, size) == 0)
+			return &other.second;
+	}
+
+	return nullptr;
+}
+
+bool event_index::wants(uint16_t command, unsigned numeric, const char *name, std::size_t size) const
+{
+	if (has_any_command)
+		return true;
+
+	const bucket *found = find(command, numeric, name, size);
+
+	return found && (!found->any_target.empty() || !found->targets.empty());
+}
+
+void event_index::publish(cq_irc_session *session, const char *command, const cq_irc_message *message, int casemapping) const
+{
+	const char *target = message_target(message);
+	std::size_t target_size = target ? strlen(target) : 0;
+	uint32_t key = target ? casehash(target, target_size, key_casemapping) : 0;
+
+	auto deliver = [&](const bucket &from) {
+		for (const subscription *sub : from.any_target) {
+			if (matches_sender(*sub, message, casemapping))
+				sub->handler(session, command, message, sub->data);
+		}
+
+		if (!target || from.targets.empty())
+			return;
+
+		auto found = from.targets.find(key);
+
+		if (found == from.targets.end())
+			return;
+
+		for (const subscription *sub : found->second) {
+			if (casecmp(sub->target.data(), sub->target.size(), target, target_size, casemapping) == 0 &&
+			    matches_sender(*sub, message, casemapping))
+				sub->handler(session, command, message, sub->data);
+		}
+	};
+
+	const bucket *own = find(message->command, message->numeric, command, command ? strlen(command) : 0);
+
+	if (own)
+		deliver(*own);
+
+	if (has_any_command)
+		deliver(any_command);
+}
+
+}
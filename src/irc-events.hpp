@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "irc-client.h"
+
+namespace cq_irc {
+
+/* A handler registered with cq_irc_service_subscribe(), its filter
+ * taken apart once. Empty strings match anything; the sender parts are
+ * globs (* and ?). */
+struct subscription {
+	cq_irc_event_handler handler;
+	void *data;
+
+	uint16_t command;  /* CQ_IRC_COMMAND_UNKNOWN with name set for others */
+	unsigned numeric;
+	std::string name;
+	bool any_command;
+
+	std::string target;
+	std::string nick, user, host;
+};
+
+/* Fills in out from filter. False for a command or target that is empty
+ * or has spaces in it. */
+bool compile_filter(const cq_irc_filter &filter, subscription &out);
+
+/* Every subscription of a service, bucketed by the command it wants and
+ * within that by the case-folded hash of its target, so a message finds
+ * the subscribers it may concern with one lookup per bucket: its own
+ * command's and the one of subscribers to any command. Only the sender
+ * mask is then checked one by one. Built whole on every change and
+ * never modified after. */
+class event_index {
+public:
+	explicit event_index(std::vector<std::shared_ptr<const subscription>> subscriptions);
+
+	/* Whether any subscriber could want a message with this command, so
+	 * the lexer knows to parse it. name is the command text. */
+	bool wants(uint16_t command, unsigned numeric, const char *name, std::size_t size) const;
+
+	/* Calls every subscriber whose filter the message matches. command
+	 * is the command text, or NULL for one classify() knows. */
+	void publish(cq_irc_session *session, const char *command, const cq_irc_message *message, int casemapping) const;
+
+private:
+	struct bucket {
+		std::vector<const subscription*> any_target;
+		std::unordered_map<uint32_t, std::vector<const subscription*>> targets;
+	};
+
+	void add(bucket &to, const subscription *sub);
+	const bucket *find(uint16_t command, unsigned numeric, const char *name, std::size_t size) const;
+
+	std::vector<std::shared_ptr<const subscription>> all;
+	bucket any_command;
+	bool has_any_command = false;
+	std::vector<bucket> commands; /* by cq_irc_command */
+	std::unordered_map<unsigned, bucket> numerics;
+	std::vector<std::pair<std::string, bucket>> others;
+};
+
+}
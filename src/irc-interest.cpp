@@ -0,0 +1,123 @@
+#include "irc-interest.h++"
+#include "irc-casemap.h++"
+#include "irc-dispatch.h++"
+
+#include <cstring>
+#include <strings.h>
+
+namespace cq_irc {
+
+namespace {
+
+	const char *skip_spaces(const char *p, const char *end)
+	{
+		while (p < end && *p == ' ')
+			++p;
+
+		return p;
+	}
+
+	const char *find_space(const char *p, const char *end)
+	{
+		const char *space = static_cast<const char*>(memchr(p, ' ', end - p));
+
+		return space ? space : end;
+	}
+}
+
+bool peek_line(const char *line, std::size_t size, line_peek &out)
+{
+	const char *end = line + size;
+
+	while (end > line && (end[-1] == '\r' || end[-1] == '\n'))
+		--end;
+
+	const char *p = line;
+
+	if (p < end && *p == ':')
+		p = skip_spaces(find_space(p, end), end);
+
+	out.command = p;
+	p = find_space(p, end);
+	out.command_size = p - out.command;
+
+	p = skip_spaces(p, end);
+
+	if (p == end) {
+		out.target = nullptr;
+		out.target_size = 0;
+	} else if (*p == ':') {
+		out.target = p + 1;
+		out.target_size = end - p - 1;
+	} else {
+		out.target = p;
+		out.target_size = find_space(p, end) - p;
+	}
+
+	return out.command_size != 0;
+}
+
+void interest::add_command(const char *command, std::size_t size)
+{
+	uint16_t id, numeric;
+
+	classify(command, size, id, numeric);
+	any_command = true;
+
+	if (id == CQ_IRC_COMMAND_NUMERIC)
+		numerics.set(numeric);
+	else if (id != CQ_IRC_COMMAND_UNKNOWN)
+		commands.set(id);
+	else
+		others.emplace_back(command, size);
+}
+
+void interest::add_target(const char *target, std::size_t size)
+{
+	targets.emplace_back(target, size);
+}
+
+bool interest::wants(uint16_t command, unsigned numeric,
+	const char *name, std::size_t name_size,
+	const char *target, std::size_t target_size,
+	int casemapping) const
+{
+	if (!any_command && targets.empty())
+		return true;
+
+	if (command == CQ_IRC_COMMAND_NUMERIC)
+		return !any_command || numerics.test(numeric);
+
+	if (any_command) {
+		bool listed = false;
+
+		if (command != CQ_IRC_COMMAND_UNKNOWN) {
+			listed = commands.test(command);
+		} else {
+			for (const std::string &other : others) {
+				if (other.size() == name_size && strncasecmp(other.data(), name, name_size) == 0) {
+					listed = true;
+					break;
+				}
+			}
+		}
+
+		if (!listed)
+			return false;
+	}
+
+	if (targets.empty())
+		return true;
+
+	if (!target)
+		return false;
+
+	for (const std::string &wanted : targets) {
+		if (casecmp(wanted.data(), wanted.size(), target, target_size, casemapping) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+}
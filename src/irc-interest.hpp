@@ -0,0 +1,48 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "irc-client.h"
+
+namespace cq_irc {
+
+/* The command token and first parameter of a raw line, found without
+ * copying or lexing it. Both point into the line; target is nullptr if
+ * the line has no parameters. */
+struct line_peek {
+	const char *command;
+	std::size_t command_size;
+	const char *target;
+	std::size_t target_size;
+};
+
+bool peek_line(const char *line, std::size_t size, line_peek &out);
+
+/* Which lines a session's user wants to see. An empty set wants
+ * everything. Once a command is added, only the commands added pass;
+ * once a target is added, those commands pass only when their first
+ * parameter is one of the targets. Numerics are matched on command
+ * alone, their first parameter being our own nick. */
+class interest {
+public:
+	void add_command(const char *command, std::size_t size);
+	void add_target(const char *target, std::size_t size);
+
+	bool wants(uint16_t command, unsigned numeric,
+		const char *name, std::size_t name_size,
+		const char *target, std::size_t target_size,
+		int casemapping) const;
+
+private:
+	bool any_command = false;
+	std::bitset<CQ_IRC_COMMAND_COUNT> commands;
+	std::bitset<1000> numerics;
+	std::vector<std::string> others; /* commands classify() doesn't know */
+	std::vector<std::string> targets;
+};
+
+}
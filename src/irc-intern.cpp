@@ -0,0 +1,254 @@
+#include "irc-intern.h++"
+
+namespace cq_irc {
+
+const uint32_t intern_pool::none;
+const uint32_t shared_intern_pool::shard_count;
+
+uint32_t hash_bytes(const char *data, std::size_t size)
+{
+	uint32_t hash = 2166136261u;
+
+	for (std::size_t i = 0; i < size; ++i) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+intern_pool::intern_pool(uint32_t _stride, uint32_t _offset)
+	: stride(_stride), offset(_offset)
+{ }
+
+intern_pool::~intern_pool()
+{
+	for (entry &e : entries)
+		delete[] e.memory;
+}
+
+/* Slot where the string lives, or the empty slot it would go in. */
+std::size_t intern_pool::probe(const char *data, std::size_t size, uint32_t hash) const
+{
+	std::size_t mask = slots.size() - 1;
+
+	for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+		if (slots[i] == none)
+			return i;
+
+		const entry &e = entries[slots[i]];
+
+		if (e.hash == hash && e.size == size && memcmp(e.memory + sizeof(uint32_t), data, size) == 0)
+			return i;
+	}
+}
+
+const char *intern_pool::find(const char *data, std::size_t size, uint32_t hash) const
+{
+	if (slots.empty())
+		return nullptr;
+
+	uint32_t index = slots[probe(data, size, hash)];
+
+	return index == none ? nullptr : entries[index].memory + sizeof(uint32_t);
+}
+
+const char *intern_pool::intern(const char *data, std::size_t size, uint32_t hash)
+{
+	if ((live + 1) * 4 > slots.size() * 3)
+		grow();
+
+	std::size_t slot = probe(data, size, hash);
+
+	if (slots[slot] == none) {
+		uint32_t index;
+
+		if (free_entries.empty()) {
+			index = entries.size();
+			entries.push_back(entry());
+		} else {
+			index = free_entries.back();
+			free_entries.pop_back();
+		}
+
+		uint32_t id = offset + stride * index;
+		char *memory = new char[sizeof(id) + size + 1];
+
+		memcpy(memory, &id, sizeof(id));
+		memcpy(memory + sizeof(id), data, size);
+		memory[sizeof(id) + size] = '\0';
+
+		entries[index] = entry { memory, static_cast<uint32_t>(size), hash, 0 };
+		slots[slot] = index;
+		++live;
+	}
+
+	entry &e = entries[slots[slot]];
+
+	++e.refs;
+
+	return e.memory + sizeof(uint32_t);
+}
+
+void intern_pool::retain(uint32_t id)
+{
+	++entries[(id - offset) / stride].refs;
+}
+
+void intern_pool::release(uint32_t id)
+{
+	uint32_t index = (id - offset) / stride;
+
+	if (--entries[index].refs == 0)
+		erase(index);
+}
+
+/* Takes the entry out of the table, shifting back whatever probed past
+ * it so no lookup stops short at the hole. */
+void intern_pool::erase(uint32_t index)
+{
+	entry &e = entries[index];
+	std::size_t mask = slots.size() - 1;
+	std::size_t hole = e.hash & mask;
+
+	while (slots[hole] != index)
+		hole = (hole + 1) & mask;
+
+	for (std::size_t next = (hole + 1) & mask; slots[next] != none; next = (next + 1) & mask) {
+		std::size_t home = entries[slots[next]].hash & mask;
+
+		/* Moves only entries whose home isn't in (hole, next]. */
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			slots[hole] = slots[next];
+			hole = next;
+		}
+	}
+
+	slots[hole] = none;
+
+	delete[] e.memory;
+	e.memory = nullptr;
+	free_entries.push_back(index);
+	--live;
+}
+
+void intern_pool::grow()
+{
+	slots.assign(slots.empty() ? 64 : slots.size() * 2, none);
+
+	std::size_t mask = slots.size() - 1;
+
+	for (uint32_t index = 0; index < entries.size(); ++index) {
+		if (!entries[index].memory)
+			continue;
+
+		std::size_t i = entries[index].hash & mask;
+
+		while (slots[i] != none)
+			i = (i + 1) & mask;
+
+		slots[i] = index;
+	}
+}
+
+shared_intern_pool::shared_intern_pool()
+{
+	for (uint32_t i = 0; i < shard_count; ++i)
+		shards[i].pool.reset(new intern_pool(shard_count, i));
+}
+
+/* Shards are picked by the top bits of the hash; the pools probe with
+ * the bottom ones. */
+const char *shared_intern_pool::intern(const char *data, std::size_t size)
+{
+	uint32_t hash = hash_bytes(data, size);
+	shard &s = shards[hash >> 28];
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	return s.pool->intern(data, size, hash);
+}
+
+const char *shared_intern_pool::find(const char *data, std::size_t size)
+{
+	uint32_t hash = hash_bytes(data, size);
+	shard &s = shards[hash >> 28];
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	return s.pool->find(data, size, hash);
+}
+
+void shared_intern_pool::retain(const char *handle)
+{
+	uint32_t id = intern_pool::id(handle);
+	shard &s = shards[id % shard_count];
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	s.pool->retain(id);
+}
+
+void shared_intern_pool::release(const char *handle)
+{
+	release_id(intern_pool::id(handle));
+}
+
+void shared_intern_pool::release_id(uint32_t id)
+{
+	shard &s = shards[id % shard_count];
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	s.pool->release(id);
+}
+
+std::size_t shared_intern_pool::size()
+{
+	std::size_t total = 0;
+
+	for (shard &s : shards) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+
+		total += s.pool->size();
+	}
+
+	return total;
+}
+
+const char *pin_list::intern(const char *data, std::size_t size)
+{
+	static const std::size_t recent = 8;
+
+	for (std::size_t i = strings.size(); i > 0 && i + recent > strings.size(); --i) {
+		const char *handle = strings[i - 1];
+
+		if (strncmp(handle, data, size) == 0 && handle[size] == '\0')
+			return handle;
+	}
+
+	const char *handle = pool.intern(data, size);
+
+	strings.push_back(handle);
+
+	return handle;
+}
+
+void pins_push(std::atomic<pin_list*> &head, pin_list *list)
+{
+	list->next = head.load(std::memory_order_relaxed);
+
+	while (!head.compare_exchange_weak(list->next, list, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+void pins_release(pin_list *list)
+{
+	while (list) {
+		pin_list *next = list->next;
+
+		for (const char *handle : list->strings)
+			list->pool.release(handle);
+
+		delete list;
+		list = next;
+	}
+}
+
+}
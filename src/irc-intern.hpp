@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace cq_irc {
+
+/* FNV-1a */
+uint32_t hash_bytes(const char *data, std::size_t size);
+
+/* Stores each distinct string once. The handle for a string is a
+ * pointer to its NUL-terminated bytes, which don't move while the
+ * string is in the pool, so two live handles are equal exactly when the
+ * strings are. A 32-bit id is stored just in front of every string for
+ * use as a compact table key.
+ *
+ * Every intern() takes a reference and the string is freed, and its id
+ * reused, once release() drops the last. Not thread-safe. */
+class intern_pool {
+public:
+	/* Ids handed out are offset + stride * n, n being a slot number. */
+	explicit intern_pool(uint32_t stride = 1, uint32_t offset = 0);
+	~intern_pool();
+
+	intern_pool(const intern_pool&) = delete;
+	intern_pool &operator=(const intern_pool&) = delete;
+
+	const char *intern(const char *data, std::size_t size, uint32_t hash);
+
+	/* Like intern() but never adds or takes a reference; returns
+	 * nullptr if absent. */
+	const char *find(const char *data, std::size_t size, uint32_t hash) const;
+
+	void retain(uint32_t id);
+	void release(uint32_t id);
+
+	/* Strings currently held. */
+	std::size_t size() const
+	{
+		return live;
+	}
+
+	static uint32_t id(const char *handle)
+	{
+		uint32_t result;
+
+		memcpy(&result, handle - sizeof(result), sizeof(result));
+
+		return result;
+	}
+
+private:
+	struct entry {
+		char *memory; /* [id][bytes][NUL], null for a free entry */
+		uint32_t size;
+		uint32_t hash;
+		uint32_t refs;
+	};
+
+	static const uint32_t none = ~0u;
+
+	uint32_t stride;
+	uint32_t offset;
+	std::size_t live = 0;
+	std::vector<entry> entries;
+	std::vector<uint32_t> free_entries;
+	std::vector<uint32_t> slots; /* entry index or none */
+
+	std::size_t probe(const char *data, std::size_t size, uint32_t hash) const;
+	void erase(uint32_t index);
+	void grow();
+};
+
+/* The service-wide pool every session and parse thread interns into.
+ * Strings are spread over shards by hash, each behind its own lock, so
+ * threads interning different names rarely contend. A string's id says
+ * which shard holds it. */
+class shared_intern_pool {
+public:
+	shared_intern_pool();
+
+	const char *intern(const char *data, std::size_t size);
+	const char *find(const char *data, std::size_t size);
+
+	void retain(const char *handle);
+	void release(const char *handle);
+	void release_id(uint32_t id);
+
+	std::size_t size();
+
+	static uint32_t id(const char *handle)
+	{
+		return intern_pool::id(handle);
+	}
+
+private:
+	static const uint32_t shard_count = 16;
+
+	struct shard {
+		std::mutex mutex;
+		std::unique_ptr<intern_pool> pool;
+	};
+
+	shard shards[shard_count];
+};
+
+/* References to interned strings that live as long as something else,
+ * such as the receive chunk whose messages point at them. Lists are
+ * chained so several parse jobs can hand theirs to one chunk. */
+struct pin_list {
+	explicit pin_list(shared_intern_pool &_pool)
+		: pool(_pool)
+	{ }
+
+	pin_list *next = nullptr;
+	shared_intern_pool &pool;
+	std::vector<const char*> strings;
+
+	/* Interns the string with a reference held by the list. Reuses one of
+	 * the last few strings pinned when it matches, since the lines of a
+	 * read tend to repeat senders and channels, without touching the
+	 * pool. */
+	const char *intern(const char *data, std::size_t size);
+};
+
+/* Adds list to the chain at head. Safe from any thread. */
+void pins_push(std::atomic<pin_list*> &head, pin_list *list);
+
+/* Releases every string of the chain and frees it. */
+void pins_release(pin_list *list);
+
+}
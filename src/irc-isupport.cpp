@@ -0,0 +1,267 @@
+#include "irc-isupport.h++"
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace cq_irc {
+
+namespace {
+
+	/* An empty value means "no limit" for the numeric tokens. */
+	unsigned parse_limit(const char *value, std::size_t size)
+	{
+		if (size == 0)
+			return unlimited;
+
+		unsigned result = 0;
+
+		for (std::size_t i = 0; i < size; ++i) {
+			if (value[i] < '0' || value[i] > '9')
+				break;
+
+			result = result * 10 + (value[i] - '0');
+		}
+
+		return result;
+	}
+
+	bool token_is(const char *name, std::size_t size, const char *wanted)
+	{
+		return strlen(wanted) == size && strncasecmp(name, wanted, size) == 0;
+	}
+
+	/* Truncating copy that always terminates. */
+	template <std::size_t N>
+	void copy_text(char (&out)[N], const char *value, std::size_t size)
+	{
+		if (size >= N)
+			size = N - 1;
+
+		memcpy(out, value, size);
+		out[size] = '\0';
+	}
+
+	/* Publishes a table built off to the side, one store per entry, so
+	 * a reader never catches an entry cleared on its way to the value it
+	 * keeps. */
+	template <typename T>
+	void publish(std::atomic<T> (&table)[256], const T (&built)[256])
+	{
+		for (int i = 0; i < 256; ++i)
+			table[i].store(built[i], std::memory_order_relaxed);
+	}
+
+	/* Both rebuilds must be called with text_mutex held. */
+	void rebuild_chantypes(isupport &caps)
+	{
+		uint8_t chantype[256] = {};
+
+		for (const char *c = caps.chantypes; *c; ++c)
+			chantype[static_cast<unsigned char>(*c)] = 1;
+
+		publish(caps.chantype, chantype);
+	}
+
+	void rebuild_chanmodes(isupport &caps)
+	{
+		uint8_t chanmode[256];
+		uint8_t prefix_rank[256] = {};
+		char prefix_by_symbol[256] = {};
+
+		memset(chanmode, CQ_IRC_CHANMODE_NONE, sizeof(chanmode));
+
+		for (int group = 0; group < 4; ++group) {
+			for (const char *c = caps.chanmodes[group]; *c; ++c)
+				chanmode[static_cast<unsigned char>(*c)] = CQ_IRC_CHANMODE_LIST + group;
+		}
+
+		for (int rank = 0; caps.prefix_modes[rank] && caps.prefix_symbols[rank]; ++rank) {
+			unsigned char mode = caps.prefix_modes[rank];
+			unsigned char symbol = caps.prefix_symbols[rank];
+
+			chanmode[mode] = CQ_IRC_CHANMODE_PREFIX;
+			prefix_rank[mode] = rank + 1;
+			prefix_by_symbol[symbol] = mode;
+		}
+
+		publish(caps.chanmode, chanmode);
+		publish(caps.prefix_rank, prefix_rank);
+		publish(caps.prefix_by_symbol, prefix_by_symbol);
+	}
+
+	/* PREFIX=(ov)@+ */
+	void parse_prefix(isupport &caps, const char *value)
+	{
+		const char *close = strchr(value, ')');
+
+		if (value[0] != '(' || !close) {
+			caps.prefix_modes[0] = '\0';
+			caps.prefix_symbols[0] = '\0';
+		} else {
+			copy_text(caps.prefix_modes, value + 1, close - value - 1);
+			copy_text(caps.prefix_symbols, close + 1, strlen(close + 1));
+		}
+
+		rebuild_chanmodes(caps);
+	}
+
+	/* CHANMODES=beI,k,l,imnpst */
+	void parse_chanmodes(isupport &caps, const char *value)
+	{
+		for (int group = 0; group < 4; ++group) {
+			const char *end = strchr(value, ',');
+
+			if (!end)
+				end = value + strlen(value);
+
+			copy_text(caps.chanmodes[group], value, end - value);
+			value = *end ? end + 1 : end;
+		}
+
+		rebuild_chanmodes(caps);
+	}
+
+	void parse_casemapping(isupport &caps, const char *value)
+	{
+		if (strcasecmp(value, "ascii") == 0)
+			caps.casemapping = CQ_IRC_CASEMAPPING_ASCII;
+		else if (strcasecmp(value, "strict-rfc1459") == 0)
+			caps.casemapping = CQ_IRC_CASEMAPPING_STRICT_RFC1459;
+		else
+			caps.casemapping = CQ_IRC_CASEMAPPING_RFC1459;
+	}
+
+	/* TARGMAX=PRIVMSG:4,NOTICE:4,JOIN: */
+	void parse_targmax(isupport &caps, const char *value)
+	{
+		caps.targmax_privmsg = 1;
+		caps.targmax_notice = 1;
+
+		while (*value) {
+			const char *end = strchr(value, ',');
+			const char *colon = strchr(value, ':');
+
+			if (!end)
+				end = value + strlen(value);
+
+			if (colon && colon < end) {
+				std::size_t name_size = colon - value;
+				unsigned limit = parse_limit(colon + 1, end - colon - 1);
+
+				if (token_is(value, name_size, "PRIVMSG"))
+					caps.targmax_privmsg = limit;
+				else if (token_is(value, name_size, "NOTICE"))
+					caps.targmax_notice = limit;
+			}
+
+			value = *end ? end + 1 : end;
+		}
+	}
+}
+
+isupport::isupport()
+{
+	std::lock_guard<std::mutex> lock(text_mutex);
+
+	copy_text(chantypes, "#&", 2);
+	copy_text(prefix_modes, "ov", 2);
+	copy_text(prefix_symbols, "@+", 2);
+	copy_text(chanmodes[0], "b", 1);
+	copy_text(chanmodes[1], "k", 1);
+	copy_text(chanmodes[2], "l", 1);
+	copy_text(chanmodes[3], "imnpst", 6);
+	network[0] = '\0';
+
+	rebuild_chantypes(*this);
+	rebuild_chanmodes(*this);
+}
+
+unsigned isupport::targets_for(bool notice) const
+{
+	unsigned limit = notice ? targmax_notice.load() : targmax_privmsg.load();
+
+	return limit ? limit : maxtargets.load();
+}
+
+void isupport::snapshot(cq_irc_isupport &out)
+{
+	std::lock_guard<std::mutex> lock(text_mutex);
+
+	out.casemapping = static_cast<cq_irc_casemapping>(casemapping.load());
+	memcpy(out.prefix_modes, prefix_modes, sizeof(out.prefix_modes));
+	memcpy(out.prefix_symbols, prefix_symbols, sizeof(out.prefix_symbols));
+	memcpy(out.chantypes, chantypes, sizeof(out.chantypes));
+	memcpy(out.chanmodes, chanmodes, sizeof(out.chanmodes));
+	memcpy(out.network, network, sizeof(out.network));
+
+	out.modes = modes;
+	out.nicklen = nicklen;
+	out.channellen = channellen;
+	out.topiclen = topiclen;
+	out.kicklen = kicklen;
+	out.maxtargets = maxtargets;
+	out.targmax_privmsg = targmax_privmsg;
+	out.targmax_notice = targmax_notice;
+	out.linelen = linelen;
+}
+
+void isupport_parse(isupport &caps, const char *token)
+{
+	bool negated = token[0] == '-';
+
+	if (negated)
+		++token;
+
+	const char *equals = strchr(token, '=');
+	std::size_t name_size = equals ? equals - token : strlen(token);
+	const char *value = equals ? equals + 1 : "";
+
+	if (token_is(token, name_size, "TARGMAX")) {
+		if (negated) {
+			caps.targmax_privmsg = 0;
+			caps.targmax_notice = 0;
+		} else {
+			parse_targmax(caps, value);
+		}
+	} else if (token_is(token, name_size, "MAXTARGETS")) {
+		caps.maxtargets = negated ? 1 : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "LINELEN")) {
+		unsigned linelen = negated ? 512 : parse_limit(value, strlen(value));
+
+		/* Never go below what RFC 1459 guarantees. */
+		caps.linelen = (linelen < 512 || linelen == unlimited) ? 512 : linelen;
+	} else if (token_is(token, name_size, "MODES")) {
+		caps.modes = negated ? 3 : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "NICKLEN")) {
+		caps.nicklen = negated ? 9 : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "CHANNELLEN")) {
+		caps.channellen = negated ? 200 : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "TOPICLEN")) {
+		caps.topiclen = negated ? unlimited : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "KICKLEN")) {
+		caps.kicklen = negated ? unlimited : parse_limit(value, strlen(value));
+	} else if (token_is(token, name_size, "CASEMAPPING")) {
+		parse_casemapping(caps, negated ? "rfc1459" : value);
+	} else if (token_is(token, name_size, "PREFIX")) {
+		std::lock_guard<std::mutex> lock(caps.text_mutex);
+
+		parse_prefix(caps, negated ? "(ov)@+" : value);
+	} else if (token_is(token, name_size, "CHANMODES")) {
+		std::lock_guard<std::mutex> lock(caps.text_mutex);
+
+		parse_chanmodes(caps, negated ? "b,k,l,imnpst" : value);
+	} else if (token_is(token, name_size, "CHANTYPES")) {
+		std::lock_guard<std::mutex> lock(caps.text_mutex);
+		const char *types = negated ? "#&" : value;
+
+		copy_text(caps.chantypes, types, strlen(types));
+		rebuild_chantypes(caps);
+	} else if (token_is(token, name_size, "NETWORK")) {
+		std::lock_guard<std::mutex> lock(caps.text_mutex);
+
+		copy_text(caps.network, value, negated ? 0 : strlen(value));
+	}
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+#include "irc-client.h"
+
+/* Server capabilities advertised through RPL_ISUPPORT (005). Tokens are
+ * applied one at a time as 005 lines arrive. Numeric limits live in
+ * atomics and per-character properties in byte-indexed tables, so any
+ * thread can query them without locking or touching a string. The
+ * original token text is kept only for cq_irc_session_get_isupport(). */
+
+namespace cq_irc {
+
+const unsigned unlimited = ~0u;
+
+struct isupport {
+	isupport();
+
+	std::atomic<unsigned> maxtargets { 1 };
+	std::atomic<unsigned> targmax_privmsg { 0 }; /* 0 until TARGMAX is seen */
+	std::atomic<unsigned> targmax_notice { 0 };
+	std::atomic<unsigned> linelen { 512 };
+	std::atomic<unsigned> modes { 3 };
+	std::atomic<unsigned> nicklen { 9 };
+	std::atomic<unsigned> channellen { 200 };
+	std::atomic<unsigned> topiclen { unlimited };
+	std::atomic<unsigned> kicklen { unlimited };
+	std::atomic<int> casemapping { CQ_IRC_CASEMAPPING_RFC1459 };
+
+	/* Indexed by byte value. */
+	std::atomic<uint8_t> chantype[256];       /* nonzero for channel prefixes */
+	std::atomic<uint8_t> chanmode[256];       /* cq_irc_chanmode_type */
+	std::atomic<uint8_t> prefix_rank[256];    /* by mode letter, 1 = highest, 0 = none */
+	std::atomic<char> prefix_by_symbol[256];  /* mode letter for a PREFIX symbol */
+
+	std::mutex text_mutex;
+	char prefix_modes[16];
+	char prefix_symbols[16];
+	char chantypes[16];
+	char chanmodes[4][64];
+	char network[64];
+
+	/* Targets a single PRIVMSG or NOTICE may carry. */
+	unsigned targets_for(bool notice) const;
+
+	bool is_channel(const char *name) const
+	{
+		return name && chantype[static_cast<unsigned char>(name[0])].load(std::memory_order_relaxed);
+	}
+
+	void snapshot(cq_irc_isupport &out);
+};
+
+/* Applies one 005 token ("NAME", "NAME=value" or "-NAME"). */
+void isupport_parse(isupport &caps, const char *token);
+
+}
@@ -0,0 +1,84 @@
+#include "irc-output.h++"
+
+#include <cstdlib>
+#include <new>
+
+namespace cq_irc {
+
+output_node *output_create(std::size_t size)
+{
+	void *memory = malloc(offsetof(output_node, data) + size);
+
+	if (!memory)
+		throw std::bad_alloc();
+
+	output_node *node = static_cast<output_node*>(memory);
+
+	new (&node->next) std::atomic<output_node*>(nullptr);
+	node->size = size;
+
+	return node;
+}
+
+void output_free(output_node *node)
+{
+	free(node);
+}
+
+output_queue::output_queue()
+	: head(&stub), tail(&stub)
+{
+	stub.next.store(nullptr, std::memory_order_relaxed);
+	stub.size = 0;
+}
+
+output_queue::~output_queue()
+{
+	while (output_node *node = pop())
+		output_free(node);
+}
+
+void output_queue::push(output_node *node)
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+
+	output_node *prev = head.exchange(node);
+
+	prev->next.store(node, std::memory_order_release);
+}
+
+output_node *output_queue::pop()
+{
+	output_node *first = tail;
+	output_node *next = first->next.load(std::memory_order_acquire);
+
+	if (first == &stub) {
+		if (!next)
+			return nullptr;
+
+		tail = next;
+		first = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next) {
+		tail = next;
+		return first;
+	}
+
+	/* first is the last node, unless a push is halfway done. */
+	if (first != head.load())
+		return nullptr;
+
+	push(&stub);
+	next = first->next.load(std::memory_order_acquire);
+
+	if (next) {
+		tail = next;
+		return first;
+	}
+
+	return nullptr;
+}
+
+}
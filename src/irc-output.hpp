@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace cq_irc {
+
+/* One or more whole lines on their way out, as built by a single write
+ * call, so the lines of a split message are never interleaved with
+ * another thread's. */
+struct output_node {
+	std::atomic<output_node*> next;
+	std::size_t size;
+	char data[1]; /* size bytes */
+};
+
+output_node *output_create(std::size_t size);
+void output_free(output_node *node);
+
+/* Intrusive multi-producer, single-consumer queue (Vyukov's): any thread
+ * pushes with one atomic exchange and never waits; only the thread that
+ * currently owns the session's output pops. */
+class output_queue {
+public:
+	output_queue();
+	~output_queue();
+
+	output_queue(const output_queue&) = delete;
+	output_queue &operator=(const output_queue&) = delete;
+
+	void push(output_node *node);
+
+	/* Consumer only. Returns null when the queue is empty, and also when
+	 * a push has swapped the head but not linked its node in yet, which
+	 * empty() tells apart. */
+	output_node *pop();
+
+	/* Consumer only. */
+	bool empty() const
+	{
+		return tail == &stub && head.load() == &stub;
+	}
+
+	/* Any thread: whether anything was pushed since the consumer last
+	 * emptied the queue. Reads only the producers' end. */
+	bool has_pushes() const
+	{
+		return head.load() != &stub;
+	}
+
+private:
+	std::atomic<output_node*> head;
+	output_node *tail;
+	output_node stub;
+};
+
+}
@@ -0,0 +1,58 @@
+#include "irc-plugin.h++"
+
+#include <cstdio>
+#include <dlfcn.h>
+
+namespace cq_irc {
+
+namespace {
+	/* The library closes with the last copy of its table. The table is
+	 * copied out so cq_irc_callbacks_from_library() can hand out a
+	 * writable one. */
+	struct library {
+		library(void *_handle, const cq_irc_callbacks &_callbacks)
+			: handle(_handle), callbacks(_callbacks)
+		{ }
+
+		~library()
+		{
+			dlclose(handle);
+		}
+
+		void *handle;
+		cq_irc_callbacks callbacks;
+	};
+}
+
+std::shared_ptr<const cq_irc_callbacks> plugin_open(const char *path)
+{
+	/* RTLD_NOW so a missing symbol fails here rather than in the middle
+	 * of a handler. */
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+	if (!handle) {
+		printf("Failed to load plugin: %s\n", dlerror());
+		return nullptr;
+	}
+
+	const cq_irc_callbacks *table =
+		static_cast<const cq_irc_callbacks*>(dlsym(handle, "cq_irc_plugin_callbacks"));
+
+	if (!table) {
+		printf("Plugin %s exports no cq_irc_plugin_callbacks.\n", path);
+		dlclose(handle);
+		return nullptr;
+	}
+
+	if (!table->signal_connect || !table->signal_disconnect) {
+		printf("Plugin %s has no signal_connect or signal_disconnect.\n", path);
+		dlclose(handle);
+		return nullptr;
+	}
+
+	std::shared_ptr<library> owner = std::make_shared<library>(handle, *table);
+
+	return std::shared_ptr<const cq_irc_callbacks>(owner, &owner->callbacks);
+}
+
+}
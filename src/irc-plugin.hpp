@@ -0,0 +1,20 @@
+#pragma once
+
+#include <memory>
+
+#include "irc-client.h"
+
+/* A loaded handler library, as handed to the user. Its callbacks share
+ * ownership of the library: it stays loaded until the handle is
+ * unloaded and no session or running handler holds the table. */
+struct cq_irc_plugin {
+	std::shared_ptr<const cq_irc_callbacks> callbacks;
+};
+
+namespace cq_irc {
+
+/* Opens the library at path and takes the callback table it exports as
+ * cq_irc_plugin_callbacks. Returns null, with a message, if it can't. */
+std::shared_ptr<const cq_irc_callbacks> plugin_open(const char *path);
+
+}
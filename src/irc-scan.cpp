@@ -0,0 +1,122 @@
+#include "irc-scan.h++"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace cq_irc {
+
+namespace {
+
+	inline bool is_line_break(char c)
+	{
+		return c == '\r' || c == '\n' || c == '\0';
+	}
+
+	inline bool is_param_break(char c)
+	{
+		return is_line_break(c) || c == ' ';
+	}
+
+#ifdef __SSE2__
+	/* Compares 16 bytes at a time against each needle; falls back to
+	 * the scalar test for the tail. */
+	template <bool Space>
+	const char *find_break(const char *data, std::size_t size)
+	{
+		const char *end = data + size;
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i nul = _mm_setzero_si128();
+		const __m128i space = _mm_set1_epi8(' ');
+
+		for (; end - data >= 16; data += 16) {
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+			__m128i hits = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)),
+				_mm_cmpeq_epi8(chunk, nul));
+
+			if (Space)
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, space));
+
+			int mask = _mm_movemask_epi8(hits);
+
+			if (mask)
+				return data + __builtin_ctz(mask);
+		}
+
+		for (; data != end; ++data) {
+			if (Space ? is_param_break(*data) : is_line_break(*data))
+				return data;
+		}
+
+		return end;
+	}
+
+	const char *find_last(const char *data, std::size_t size, char needle)
+	{
+		const char *end = data + size;
+		const char *pos = end;
+		const __m128i wanted = _mm_set1_epi8(needle);
+
+		for (; pos - data >= 16; pos -= 16) {
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos - 16));
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, wanted));
+
+			if (mask)
+				return pos - 16 + (31 - __builtin_clz(mask));
+		}
+
+		while (pos != data) {
+			if (*--pos == needle)
+				return pos;
+		}
+
+		return end;
+	}
+#else
+	template <bool Space>
+	const char *find_break(const char *data, std::size_t size)
+	{
+		const char *end = data + size;
+
+		for (; data != end; ++data) {
+			if (Space ? is_param_break(*data) : is_line_break(*data))
+				return data;
+		}
+
+		return end;
+	}
+
+	const char *find_last(const char *data, std::size_t size, char needle)
+	{
+		const char *end = data + size;
+		const char *pos = end;
+
+		while (pos != data) {
+			if (*--pos == needle)
+				return pos;
+		}
+
+		return end;
+	}
+#endif
+
+}
+
+const char *find_line_break(const char *data, std::size_t size)
+{
+	return find_break<false>(data, size);
+}
+
+const char *find_param_break(const char *data, std::size_t size)
+{
+	return find_break<true>(data, size);
+}
+
+const char *find_last_space(const char *data, std::size_t size)
+{
+	return find_last(data, size, ' ');
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+/* Byte scanning kernels shared by the parser and the outbound path.
+ * All of them return end (data + size) when nothing is found. */
+
+namespace cq_irc {
+
+/* First CR, LF or NUL. Anything found here must never reach the wire
+ * inside a parameter or trailing argument. */
+const char *find_line_break(const char *data, std::size_t size);
+
+/* First CR, LF, NUL or space, i.e. the end of a middle parameter. */
+const char *find_param_break(const char *data, std::size_t size);
+
+/* Last space in the range, scanning backwards. */
+const char *find_last_space(const char *data, std::size_t size);
+
+}
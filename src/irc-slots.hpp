@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace cq_irc {
+
+/* Items kept packed in one array, named by handles that can be checked.
+ * A handle is a slot index in its low 32 bits and the slot's generation
+ * in its high 32. Removing an item bumps its slot's generation, so old
+ * handles stop resolving even once the slot is reused, and moves the
+ * last item into the hole. Generations start at 1, so 0 is never a
+ * handle. Not thread-safe. */
+template <typename T>
+class slot_map {
+public:
+	uint64_t insert(const T &value)
+	{
+		uint32_t index;
+
+		if (free_slots.empty()) {
+			index = static_cast<uint32_t>(slots.size());
+			slots.push_back(slot { 1, 0 });
+		} else {
+			index = free_slots.back();
+			free_slots.pop_back();
+		}
+
+		slots[index].item = static_cast<uint32_t>(items.size());
+		items.push_back(value);
+		owners.push_back(index);
+
+		return make_handle(index, slots[index].generation);
+	}
+
+	bool remove(uint64_t handle)
+	{
+		uint32_t index = static_cast<uint32_t>(handle);
+
+		if (!valid(handle))
+			return false;
+
+		uint32_t item = slots[index].item;
+		uint32_t last = static_cast<uint32_t>(items.size() - 1);
+
+		items[item] = items[last];
+		owners[item] = owners[last];
+		slots[owners[item]].item = item;
+		items.pop_back();
+		owners.pop_back();
+
+		++slots[index].generation;
+		free_slots.push_back(index);
+
+		return true;
+	}
+
+	/* Null once the item is removed. */
+	T *find(uint64_t handle)
+	{
+		return valid(handle) ? &items[slots[static_cast<uint32_t>(handle)].item] : nullptr;
+	}
+
+	std::size_t size() const
+	{
+		return items.size();
+	}
+
+	typename std::vector<T>::iterator begin() { return items.begin(); }
+	typename std::vector<T>::iterator end() { return items.end(); }
+
+private:
+	struct slot {
+		uint32_t generation;
+		uint32_t item; /* index into items while live */
+	};
+
+	std::vector<slot> slots;
+	std::vector<T> items;
+	std::vector<uint32_t> owners; /* slot of each item */
+	std::vector<uint32_t> free_slots;
+
+	static uint64_t make_handle(uint32_t index, uint32_t generation)
+	{
+		return static_cast<uint64_t>(generation) << 32 | index;
+	}
+
+	bool valid(uint64_t handle) const
+	{
+		uint32_t index = static_cast<uint32_t>(handle);
+
+		return index < slots.size() &&
+			slots[index].generation == static_cast<uint32_t>(handle >> 32) &&
+			slots[index].item < owners.size() &&
+			owners[slots[index].item] == index;
+	}
+};
+
+}
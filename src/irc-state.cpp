@@ -0,0 +1,494 @@
+#include "irc-state.h++"
+#include "irc-casemap.h++"
+#include "irc-dispatch.h++"
+
+#include <cstring>
+
+namespace cq_irc {
+
+namespace {
+
+	const uint32_t none = ~0u;
+
+	/* Longest name we fold; IRC lines can't carry anything longer. */
+	const std::size_t max_name = 512;
+
+	std::size_t fold(const char *name, std::size_t size, char *out, int casemapping)
+	{
+		if (size > max_name)
+			size = max_name;
+
+		casefold(name, size, out, casemapping);
+
+		return size;
+	}
+
+	void copy_out(const char *text, std::size_t size, char *out, std::size_t out_size)
+	{
+		if (!out_size)
+			return;
+
+		if (size >= out_size)
+			size = out_size - 1;
+
+		memcpy(out, text, size);
+		out[size] = '\0';
+	}
+}
+
+state_tracker::state_tracker(isupport &_caps, shared_intern_pool &_strings)
+	: caps(_caps), strings(_strings)
+{ }
+
+state_tracker::~state_tracker()
+{
+	for (user &u : users) {
+		if (u.nick) {
+			replace(u.nick, nullptr, 0);
+			strings.release_id(u.folded);
+		}
+	}
+
+	for (channel &c : channels) {
+		if (c.name) {
+			replace(c.name, nullptr, 0);
+			strings.release_id(c.folded);
+		}
+	}
+}
+
+/* Points handle at an interned copy of text (or at nothing, for a null
+ * text), letting go of what it held before. */
+void state_tracker::replace(const char *&handle, const char *text, std::size_t size)
+{
+	const char *previous = handle;
+
+	handle = text ? strings.intern(text, size) : nullptr;
+
+	if (previous)
+		strings.release(previous);
+}
+
+uint32_t state_tracker::intern_folded(const char *name, std::size_t size)
+{
+	char buffer[max_name];
+
+	return strings.id(strings.intern(buffer, fold(name, size, buffer, caps.casemapping)));
+}
+
+uint32_t state_tracker::find_folded(const char *name) const
+{
+	char buffer[max_name];
+
+	const char *handle = strings.find(buffer, fold(name, strlen(name), buffer, caps.casemapping));
+
+	return handle ? strings.id(handle) : none;
+}
+
+uint32_t state_tracker::find_user(const char *nick) const
+{
+	uint32_t folded = find_folded(nick);
+	const uint32_t *index = folded == none ? nullptr : users_by_name.find(folded);
+
+	return index ? *index : none;
+}
+
+uint32_t state_tracker::find_channel(const char *name) const
+{
+	uint32_t folded = find_folded(name);
+	const uint32_t *index = folded == none ? nullptr : channels_by_name.find(folded);
+
+	return index ? *index : none;
+}
+
+uint32_t state_tracker::add_user(const char *nick, std::size_t size)
+{
+	uint32_t index;
+
+	if (free_users.empty()) {
+		index = users.size();
+		users.emplace_back();
+	} else {
+		index = free_users.back();
+		free_users.pop_back();
+	}
+
+	user &u = users[index];
+
+	u.nick = strings.intern(nick, size);
+	u.folded = intern_folded(nick, size);
+
+	users_by_name.insert(u.folded, index);
+
+	return index;
+}
+
+uint32_t state_tracker::add_channel(const char *name)
+{
+	uint32_t index;
+
+	if (free_channels.empty()) {
+		index = channels.size();
+		channels.emplace_back();
+	} else {
+		index = free_channels.back();
+		free_channels.pop_back();
+	}
+
+	channel &c = channels[index];
+
+	c.name = strings.intern(name, strlen(name));
+	c.folded = intern_folded(name, strlen(name));
+
+	channels_by_name.insert(c.folded, index);
+
+	return index;
+}
+
+void state_tracker::join(uint32_t chan, uint32_t index, uint32_t prefixes)
+{
+	flat_table<uint32_t> &members = channels[chan].members;
+
+	if (!members.find(index)) {
+		uint32_t at = free_links;
+
+		if (at == none) {
+			at = links.size();
+			links.emplace_back();
+		} else {
+			free_links = links[at].next;
+		}
+
+		links[at] = link { chan, users[index].channels };
+		users[index].channels = at;
+	}
+
+	members.insert(index, prefixes);
+}
+
+/* Forgets a user record, taking it out of every channel it is in. */
+void state_tracker::drop_user(uint32_t index)
+{
+	user &u = users[index];
+
+	while (u.channels != none) {
+		uint32_t at = u.channels;
+
+		channels[links[at].channel].members.erase(index);
+		u.channels = links[at].next;
+		links[at].next = free_links;
+		free_links = at;
+	}
+
+	users_by_name.erase(u.folded);
+	replace(u.nick, nullptr, 0);
+	strings.release_id(u.folded);
+	free_users.push_back(index);
+}
+
+void state_tracker::leave(uint32_t chan, uint32_t index)
+{
+	uint32_t *at = &users[index].channels;
+
+	while (*at != none && links[*at].channel != chan)
+		at = &links[*at].next;
+
+	if (*at == none)
+		return;
+
+	uint32_t found = *at;
+
+	*at = links[found].next;
+	links[found].next = free_links;
+	free_links = found;
+	channels[chan].members.erase(index);
+
+	if (users[index].channels == none)
+		drop_user(index);
+}
+
+void state_tracker::drop_channel(uint32_t chan)
+{
+	std::vector<uint32_t> indices;
+
+	channels[chan].members.for_each([&](uint32_t index, uint32_t) {
+		indices.push_back(index);
+	});
+
+	for (uint32_t index : indices)
+		leave(chan, index);
+
+	channel &c = channels[chan];
+
+	channels_by_name.erase(c.folded);
+	c.members.clear();
+	std::string().swap(c.topic);
+	replace(c.name, nullptr, 0);
+	strings.release_id(c.folded);
+	free_channels.push_back(chan);
+}
+
+void state_tracker::rename(uint32_t index, const char *nick)
+{
+	std::size_t size = strlen(nick);
+	uint32_t folded = intern_folded(nick, size);
+	const uint32_t *existing = users_by_name.find(folded);
+
+	/* A stale record under the new name can only be left over from a
+	 * missed QUIT. */
+	if (existing && *existing != index)
+		drop_user(*existing);
+
+	users_by_name.erase(users[index].folded);
+	strings.release_id(users[index].folded);
+	replace(users[index].nick, nick, size);
+	users[index].folded = folded;
+	users_by_name.insert(folded, index);
+}
+
+void state_tracker::apply_modes(uint32_t chan, const std::vector<cq_irc_mode_change> &changes)
+{
+	for (const cq_irc_mode_change &change : changes) {
+		unsigned char mode = change.mode;
+
+		if (!change.arg || caps.chanmode[mode].load(std::memory_order_relaxed) != CQ_IRC_CHANMODE_PREFIX)
+			continue;
+
+		unsigned rank = caps.prefix_rank[mode].load(std::memory_order_relaxed);
+		uint32_t bit = rank ? 1u << (rank - 1) : 0;
+		uint32_t index = find_user(change.arg);
+		uint32_t *prefixes = index == none ? nullptr : channels[chan].members.find(index);
+
+		if (prefixes)
+			*prefixes = change.sign == '+' ? (*prefixes | bit) : (*prefixes & ~bit);
+	}
+}
+
+/* RPL_NAMREPLY entries: "@+nick" or, with userhost-in-names,
+ * "@nick!user@host". */
+void state_tracker::apply_names(uint32_t chan, const char *names)
+{
+	while (names && *names) {
+		while (*names == ' ')
+			++names;
+
+		uint32_t prefixes = 0;
+		char mode;
+
+		while (*names && (mode = caps.prefix_by_symbol[static_cast<unsigned char>(*names)].load(std::memory_order_relaxed))) {
+			unsigned rank = caps.prefix_rank[static_cast<unsigned char>(mode)].load(std::memory_order_relaxed);
+
+			if (rank)
+				prefixes |= 1u << (rank - 1);
+
+			++names;
+		}
+
+		const char *end = strchr(names, ' ');
+		std::size_t size = end ? end - names : strlen(names);
+		const char *bang = static_cast<const char*>(memchr(names, '!', size));
+		std::size_t nick_size = bang ? bang - names : size;
+
+		if (nick_size) {
+			char nick[max_name + 1];
+
+			copy_out(names, nick_size, nick, sizeof(nick));
+
+			uint32_t index = find_user(nick);
+
+			if (index == none)
+				index = add_user(nick, strlen(nick));
+
+			join(chan, index, prefixes);
+		}
+
+		names += size;
+	}
+}
+
+bool state_tracker::is_us(const std::string &our_nick, const char *nick) const
+{
+	return casecmp(our_nick.data(), our_nick.size(), nick, strlen(nick), caps.casemapping) == 0;
+}
+
+void state_tracker::format_prefixes(uint32_t bits, char *out, std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(caps.text_mutex);
+	std::size_t used = 0;
+
+	for (int rank = 0; caps.prefix_symbols[rank] && used + 1 < size; ++rank) {
+		if (bits & (1u << rank))
+			out[used++] = caps.prefix_symbols[rank];
+	}
+
+	if (size)
+		out[used] = '\0';
+}
+
+void state_tracker::observe(const std::string &our_nick, const cq_irc_message *message,
+	const std::vector<cq_irc_mode_change> *modes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const char *source = message->prefix.source;
+
+	switch (message->command) {
+	case CQ_IRC_COMMAND_JOIN: {
+		const char *name = message_arg(message, 0);
+
+		if (!source || !name)
+			return;
+
+		uint32_t chan = find_channel(name);
+
+		if (is_us(our_nick, source)) {
+			if (chan != none)
+				drop_channel(chan);
+
+			chan = add_channel(name);
+		}
+
+		if (chan == none)
+			return;
+
+		uint32_t index = find_user(source);
+
+		if (index == none)
+			index = add_user(source, strlen(source));
+
+		join(chan, index, 0);
+		break;
+	}
+	case CQ_IRC_COMMAND_PART:
+	case CQ_IRC_COMMAND_KICK: {
+		bool kick = message->command == CQ_IRC_COMMAND_KICK;
+		const char *name = message_arg(message, 0);
+		const char *nick = kick ? message_arg(message, 1) : source;
+
+		if (!name || !nick)
+			return;
+
+		uint32_t chan = find_channel(name);
+		uint32_t index = find_user(nick);
+
+		if (chan == none)
+			return;
+
+		if (is_us(our_nick, nick))
+			drop_channel(chan);
+		else if (index != none)
+			leave(chan, index);
+		break;
+	}
+	case CQ_IRC_COMMAND_QUIT: {
+		uint32_t index = source ? find_user(source) : none;
+
+		if (index != none)
+			drop_user(index);
+		break;
+	}
+	case CQ_IRC_COMMAND_NICK: {
+		const char *nick = message_arg(message, 0);
+		uint32_t index = source ? find_user(source) : none;
+
+		if (nick && index != none)
+			rename(index, nick);
+		break;
+	}
+	case CQ_IRC_COMMAND_MODE: {
+		const char *name = message_arg(message, 0);
+		uint32_t chan = caps.is_channel(name) ? find_channel(name) : none;
+
+		if (chan != none && modes)
+			apply_modes(chan, *modes);
+		break;
+	}
+	case CQ_IRC_COMMAND_TOPIC:
+	case CQ_IRC_COMMAND_NUMERIC: {
+		if (message->command == CQ_IRC_COMMAND_NUMERIC && message->numeric == 353) {
+			/* me [=*@] #channel :names */
+			uint32_t chan = message->params.length ?
+				find_channel(message->params.param[message->params.length - 1]) : none;
+
+			if (chan != none)
+				apply_names(chan, message->trailing);
+			break;
+		}
+
+		if (message->command == CQ_IRC_COMMAND_NUMERIC && message->numeric != 332)
+			break;
+
+		const char *name = message_arg(message, message->command == CQ_IRC_COMMAND_NUMERIC ? 1 : 0);
+		uint32_t chan = name ? find_channel(name) : none;
+
+		if (chan != none)
+			channels[chan].topic = message->trailing ? message->trailing : "";
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+bool state_tracker::is_member(const char *channel, const char *nick)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t chan = find_channel(channel);
+	uint32_t index = find_user(nick);
+
+	return chan != none && index != none && channels[chan].members.find(index);
+}
+
+int state_tracker::member_prefixes(const char *channel, const char *nick, char *out, std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t chan = find_channel(channel);
+	uint32_t index = find_user(nick);
+	const uint32_t *prefixes = (chan == none || index == none) ?
+		nullptr : channels[chan].members.find(index);
+
+	if (!prefixes)
+		return -1;
+
+	format_prefixes(*prefixes, out, size);
+
+	return 0;
+}
+
+int state_tracker::topic(const char *channel, char *out, std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t chan = find_channel(channel);
+
+	if (chan == none)
+		return -1;
+
+	copy_out(channels[chan].topic.data(), channels[chan].topic.size(), out, size);
+
+	return channels[chan].topic.size();
+}
+
+std::size_t state_tracker::member_count(const char *channel)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t chan = find_channel(channel);
+
+	return chan == none ? 0 : channels[chan].members.size();
+}
+
+void state_tracker::for_each_member(const char *channel, void (*func)(void*, const char*, const char*), void *data)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	uint32_t chan = find_channel(channel);
+
+	if (chan == none)
+		return;
+
+	channels[chan].members.for_each([&](uint32_t index, uint32_t prefixes) {
+		char symbols[16];
+
+		format_prefixes(prefixes, symbols, sizeof(symbols));
+		func(data, users[index].nick, symbols);
+	});
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "irc-client.h"
+#include "irc-intern.h++"
+#include "irc-isupport.h++"
+#include "irc-table.h++"
+
+namespace cq_irc {
+
+/* Channels we are in, who else is in them with which prefixes, and
+ * channel topics, kept up to date from the messages the session parses.
+ *
+ * Users and channels are keyed by the id of their case-folded name in
+ * the service-wide intern pool, and hold a reference to every string
+ * they keep there, dropped when they are forgotten. Each channel holds a
+ * flat_table from user index to a bitmask of PREFIX ranks, and each user
+ * the list of channels it shares with us, so membership is one probe and
+ * QUIT/NICK touch only what they must. Those lists are chained through
+ * one shared array of links rather than a vector per user, which keeps a
+ * user down to 16 bytes plus 8 per channel. Nothing reads members' idents
+ * or hosts, so they aren't kept. */
+class state_tracker {
+public:
+	state_tracker(isupport &caps, shared_intern_pool &strings);
+	~state_tracker();
+
+	/* our_nick is who we were before this message was applied; modes
+	 * are the decoded changes of a MODE message, null otherwise. */
+	void observe(const std::string &our_nick, const cq_irc_message *message,
+		const std::vector<cq_irc_mode_change> *modes);
+
+	bool is_member(const char *channel, const char *nick);
+	int member_prefixes(const char *channel, const char *nick, char *out, std::size_t size);
+	int topic(const char *channel, char *out, std::size_t size);
+	std::size_t member_count(const char *channel);
+	void for_each_member(const char *channel, void (*func)(void*, const char*, const char*), void *data);
+
+private:
+	/* Strings are handles into the service's intern pool; folded names
+	 * are stored by id, which is what the tables are keyed on. A free
+	 * record has a null nick or name. */
+	struct user {
+		const char *nick = nullptr;
+		uint32_t folded = 0;
+		uint32_t channels = ~0u; /* first link, or ~0u */
+	};
+
+	/* One channel a user shares with us; a free link is chained to the
+	 * next free one. */
+	struct link {
+		uint32_t channel;
+		uint32_t next;
+	};
+
+	struct channel {
+		const char *name = nullptr;
+		uint32_t folded = 0;
+		std::string topic;
+		flat_table<uint32_t> members; /* user index -> prefix rank bits */
+	};
+
+	std::mutex mutex;
+	isupport &caps;
+	shared_intern_pool &strings;
+
+	flat_table<uint32_t> users_by_name;    /* folded id -> index into users */
+	flat_table<uint32_t> channels_by_name; /* folded id -> index into channels */
+	std::vector<user> users;
+	std::vector<channel> channels;
+	std::vector<link> links;
+	std::vector<uint32_t> free_users;
+	std::vector<uint32_t> free_channels;
+	uint32_t free_links = ~0u;
+
+	uint32_t intern_folded(const char *name, std::size_t size);
+	uint32_t find_folded(const char *name) const;
+
+	uint32_t find_user(const char *nick) const;
+	uint32_t find_channel(const char *name) const;
+	uint32_t add_user(const char *nick, std::size_t size);
+	uint32_t add_channel(const char *name);
+	void replace(const char *&handle, const char *text, std::size_t size);
+
+	void join(uint32_t chan, uint32_t index, uint32_t prefixes);
+	void leave(uint32_t chan, uint32_t index);
+	void drop_channel(uint32_t chan);
+	void drop_user(uint32_t index);
+	void rename(uint32_t index, const char *nick);
+
+	void apply_modes(uint32_t chan, const std::vector<cq_irc_mode_change> &changes);
+	void apply_names(uint32_t chan, const char *names);
+
+	bool is_us(const std::string &our_nick, const char *nick) const;
+	void format_prefixes(uint32_t bits, char *out, std::size_t size);
+};
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace cq_irc {
+
+/* Open-addressing hash table from 32-bit ids to small values. Linear
+ * probing over a single flat array keeps a lookup to one or two cache
+ * lines; erase shifts the rest of the probe run back rather than
+ * leaving tombstones, so the table never needs cleaning up. ~0u is
+ * reserved as the empty key. */
+template <typename Value>
+class flat_table {
+public:
+	static const uint32_t empty = ~0u;
+
+	Value *find(uint32_t key)
+	{
+		if (slots.empty())
+			return nullptr;
+
+		for (std::size_t i = home(key); ; i = (i + 1) & mask()) {
+			if (slots[i].key == key)
+				return &slots[i].value;
+			if (slots[i].key == empty)
+				return nullptr;
+		}
+	}
+
+	const Value *find(uint32_t key) const
+	{
+		return const_cast<flat_table*>(this)->find(key);
+	}
+
+	/* Inserts or overwrites. */
+	Value &insert(uint32_t key, const Value &value)
+	{
+		if ((count + 1) * 4 > slots.size() * 3)
+			grow();
+
+		std::size_t i = home(key);
+
+		while (slots[i].key != empty && slots[i].key != key)
+			i = (i + 1) & mask();
+
+		if (slots[i].key == empty) {
+			slots[i].key = key;
+			++count;
+		}
+
+		slots[i].value = value;
+
+		return slots[i].value;
+	}
+
+	bool erase(uint32_t key)
+	{
+		if (slots.empty())
+			return false;
+
+		std::size_t i = home(key);
+
+		while (slots[i].key != key) {
+			if (slots[i].key == empty)
+				return false;
+
+			i = (i + 1) & mask();
+		}
+
+		for (std::size_t j = i; ; ) {
+			j = (j + 1) & mask();
+
+			if (slots[j].key == empty)
+				break;
+
+			std::size_t k = home(slots[j].key);
+
+			/* Leave entries whose home lies cyclically in (i, j]. */
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+				continue;
+
+			slots[i] = slots[j];
+			i = j;
+		}
+
+		slots[i].key = empty;
+		--count;
+
+		return true;
+	}
+
+	template <typename Func>
+	void for_each(Func func) const
+	{
+		for (const slot &s : slots) {
+			if (s.key != empty)
+				func(s.key, s.value);
+		}
+	}
+
+	std::size_t size() const
+	{
+		return count;
+	}
+
+	void clear()
+	{
+		slots.clear();
+		count = 0;
+	}
+
+private:
+	struct slot {
+		uint32_t key;
+		Value value;
+	};
+
+	std::vector<slot> slots;
+	std::size_t count = 0;
+
+	std::size_t mask() const
+	{
+		return slots.size() - 1;
+	}
+
+	std::size_t home(uint32_t key) const
+	{
+		key ^= key >> 16;
+		key *= 0x7feb352d;
+		key ^= key >> 15;
+
+		return key & mask();
+	}
+
+	void grow()
+	{
+		std::vector<slot> old;
+
+		old.swap(slots);
+		slots.resize(old.empty() ? 8 : old.size() * 2, slot { empty, Value() });
+		count = 0;
+
+		for (const slot &s : old) {
+			if (s.key != empty)
+				insert(s.key, s.value);
+		}
+	}
+};
+
+}
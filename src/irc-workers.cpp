@@ -0,0 +1,128 @@
+#include "irc-workers.h++"
+
+namespace cq_irc {
+
+worker_pool::worker_pool(unsigned count, std::size_t _max_queued, int _policy)
+	: max_queued(_max_queued), policy(_policy)
+{
+	for (unsigned i = 0; i < count; ++i)
+		threads.emplace_back(&worker_pool::run, this);
+}
+
+/* Jobs still waiting are destroyed unrun, outside the lock and after
+ * they have been taken off their queues: destroying one may free the
+ * owner of its queue. */
+worker_pool::~worker_pool()
+{
+	std::list<std::function<void()>> discarded;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	work_ready.notify_all();
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	for (serial_queue *queue : ready) {
+		discarded.splice(discarded.end(), queue->jobs);
+		queue->active = false;
+	}
+
+	ready.clear();
+	depth = 0;
+}
+
+bool worker_pool::submit(serial_queue &queue, std::function<void()> job)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (depth >= max_queued) {
+		switch (policy) {
+		case CQ_IRC_QUEUE_DROP:
+			++dropped;
+			return false;
+		case CQ_IRC_QUEUE_INLINE:
+			if (!queue.active) {
+				++inlined;
+				lock.unlock();
+				job();
+				return true;
+			}
+			break;
+		default:
+			/* Queued over the limit; the caller sees full() and stops
+			 * reading until there is room. */
+			break;
+		}
+	}
+
+	queue.jobs.push_back(std::move(job));
+	++queued;
+
+	if (++depth > max_depth)
+		max_depth = depth;
+
+	if (!queue.active) {
+		queue.active = true;
+		ready.push_back(&queue);
+		work_ready.notify_one();
+	}
+
+	return true;
+}
+
+bool worker_pool::full()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	return policy == CQ_IRC_QUEUE_BLOCK && depth && depth >= max_queued;
+}
+
+void worker_pool::stats(cq_irc_worker_stats &out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	out.depth = depth;
+	out.max_depth = max_depth;
+	out.queued = queued;
+	out.dropped = dropped;
+	out.inlined = inlined;
+}
+
+/* A thread takes one job from the queue at the front of the ready list
+ * and, once it's done, sends the queue to the back if it has more, so a
+ * busy session can't starve the others. */
+void worker_pool::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		work_ready.wait(lock, [this] { return !ready.empty() || stopping; });
+
+		if (stopping)
+			return;
+
+		serial_queue *queue = ready.front();
+		std::function<void()> job = std::move(queue->jobs.front());
+
+		ready.pop_front();
+		queue->jobs.pop_front();
+		--depth;
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		if (queue->jobs.empty()) {
+			queue->active = false;
+		} else {
+			ready.push_back(queue);
+			work_ready.notify_one();
+		}
+	}
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "irc-client.h"
+
+namespace cq_irc {
+
+/* Jobs that must run one at a time and in order, such as one session's
+ * callbacks. Only the pool touches the members. A list rather than a
+ * deque because every session has one and an empty deque already holds
+ * a block of memory. */
+struct serial_queue {
+	std::list<std::function<void()>> jobs;
+	bool active = false; /* waiting in the ready list or running */
+};
+
+/* A fixed set of threads running serial_queue jobs. Different queues
+ * run in parallel; each queue's jobs run in submission order, never two
+ * at once. At most max_queued jobs wait across all queues; what submit
+ * does beyond that is up to the policy (enum cq_irc_queue_policy).
+ * Submitting never blocks: under the block policy the job is queued
+ * anyway and it is up to the caller to check full() and hold off. Jobs
+ * still waiting when the pool is destroyed are destroyed unrun. */
+class worker_pool {
+public:
+	worker_pool(unsigned threads, std::size_t max_queued, int policy);
+	~worker_pool();
+
+	/* Returns false if the job was dropped, leaving it to the caller to
+	 * clean up after. Under the inline policy a full pool runs the job
+	 * on the calling thread, unless the queue still has earlier jobs
+	 * waiting, in which case it is queued over the limit to keep order. */
+	bool submit(serial_queue &queue, std::function<void()> job);
+
+	/* Under the block policy, whether max_queued jobs are waiting. */
+	bool full();
+
+	void stats(cq_irc_worker_stats &out);
+
+private:
+	std::mutex mutex;
+	std::condition_variable work_ready;
+	std::deque<serial_queue*> ready;
+	std::vector<std::thread> threads;
+	bool stopping = false;
+
+	const std::size_t max_queued;
+	const int policy;
+
+	std::size_t depth = 0;
+	std::size_t max_depth = 0;
+	uint64_t queued = 0;
+	uint64_t dropped = 0;
+	uint64_t inlined = 0;
+
+	void run();
+};
+
+}
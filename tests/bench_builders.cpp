@@ -0,0 +1,50 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "format.h"
+#include "irc-command.h++"
+
+/* Compares building a PRIVMSG line through fmt::Writer::Format, which
+ * parses the format string on every call, against the compile-time
+ * command builder used by the session. */
+
+static const int iterations = 1000000;
+
+static volatile std::size_t sink;
+
+template <typename Func>
+static double run(Func func)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < iterations; ++i)
+		func();
+
+	std::chrono::duration<double, std::nano> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	return elapsed.count() / iterations;
+}
+
+int main()
+{
+	const char *channel = "#BotDevGroundZero";
+	const char *message = "As you will, sir. This line is about as long as a typical reply.";
+
+	double fmt_ns = run([&]() {
+		fmt::Writer out;
+		out.Format("PRIVMSG {0} :{1}", channel, message);
+		sink = sink + out.size();
+	});
+
+	double builder_ns = run([&]() {
+		char line[512];
+		char *end = cq_irc::build_line(line,
+			"PRIVMSG ", cq_irc::arg(channel), " :", cq_irc::arg(message));
+		sink = sink + (end - line);
+	});
+
+	printf("fmt::Writer::Format: %8.1f ns/line\n", fmt_ns);
+	printf("cq_irc::build_line:  %8.1f ns/line\n", builder_ns);
+}
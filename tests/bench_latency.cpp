@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "irc-client.h"
+
+/* Round-trip latency of one session over loopback, in the manner of
+ * asio's tests/latency/tcp_client: the client writes a line, an echo
+ * server sends it straight back and the client times the round trip
+ * before writing the next. Runs with default settings, with the
+ * low-latency socket options and with those plus a spinning I/O
+ * thread, and prints the distribution of each in microseconds. The
+ * spinning run needs a core of its own: on a machine with fewer cores
+ * than threads it competes with the echo server. */
+
+using namespace boost::asio;
+
+typedef std::chrono::steady_clock clock_type;
+
+static int num_samples = 20000;
+
+static std::vector<double> samples;
+static clock_type::time_point sent;
+
+static void send_next(cq_irc_session *session)
+{
+	static const char line[] = "PRIVMSG #latency :ping";
+
+	sent = clock_type::now();
+	cq_irc_session_write(session, line, sizeof(line) - 1);
+}
+
+static void on_connect(cq_irc_session *session)
+{
+	cq_irc_session_set_raw(session, 1);
+	send_next(session);
+}
+
+static void on_raw(cq_irc_session *session, const cq_irc_line*, size_t count)
+{
+	std::chrono::duration<double, std::micro> elapsed = clock_type::now() - sent;
+
+	samples.push_back(elapsed.count());
+
+	if (samples.size() < static_cast<std::size_t>(num_samples))
+		send_next(session);
+	else
+		cq_irc_service_stop(cq_irc_session_get_service(session));
+}
+
+static void on_disconnect(cq_irc_session*)
+{
+}
+
+/* Echoes whatever arrives on one connection until it closes. */
+static void echo(io_service &service, ip::tcp::acceptor &acceptor)
+{
+	ip::tcp::socket socket(service);
+	boost::system::error_code error;
+	char data[1024];
+
+	acceptor.accept(socket);
+	socket.set_option(ip::tcp::no_delay(true));
+
+	for (;;) {
+		std::size_t size = socket.read_some(buffer(data), error);
+
+		if (error)
+			break;
+
+		write(socket, buffer(data, size), error);
+
+		if (error)
+			break;
+	}
+}
+
+static void report(const char *name)
+{
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0.0;
+	for (double sample : samples)
+		total += sample;
+
+	std::size_t n = samples.size();
+
+	printf("%s\n", name);
+	printf("  0.0%%\t%f\n", samples[0]);
+	printf(" 10.0%%\t%f\n", samples[n / 10 - 1]);
+	printf(" 50.0%%\t%f\n", samples[n * 5 / 10 - 1]);
+	printf(" 90.0%%\t%f\n", samples[n * 9 / 10 - 1]);
+	printf(" 99.0%%\t%f\n", samples[n * 99 / 100 - 1]);
+	printf(" 99.9%%\t%f\n", samples[n * 999 / 1000 - 1]);
+	printf("100.0%%\t%f\n", samples[n - 1]);
+	printf("  mean\t%f\n", total / n);
+}
+
+static void run(const char *name, bool low_latency, unsigned spin_us)
+{
+	io_service server_service;
+	ip::tcp::acceptor acceptor(server_service,
+		ip::tcp::endpoint(ip::address::from_string("127.0.0.1"), 0));
+	std::thread server(echo, std::ref(server_service), std::ref(acceptor));
+
+	char port[8];
+	snprintf(port, sizeof(port), "%d", acceptor.local_endpoint().port());
+
+	cq_irc_callbacks callbacks = {};
+	callbacks.signal_connect = on_connect;
+	callbacks.signal_disconnect = on_disconnect;
+	callbacks.signal_raw = on_raw;
+
+	cq_irc_service *service = cq_irc_service_create();
+
+	if (low_latency)
+		cq_irc_service_set_low_latency(service, 1, 50, spin_us);
+
+	samples.clear();
+	samples.reserve(num_samples);
+
+	cq_irc_session *session = cq_irc_session_connect(service, "127.0.0.1", port, &callbacks);
+
+	cq_irc_service_attach(service);
+
+	/* The close is a handler of the stopped service; destroying the
+	 * service runs it, and only then does the echo server see EOF. */
+	cq_irc_session_disconnect(session);
+	cq_irc_session_destroy(session);
+	cq_irc_service_destroy(service);
+	server.join();
+
+	report(name);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		num_samples = std::max(atoi(argv[1]), 1000);
+
+	run("default", false, 0);
+	run("low latency (TCP_NODELAY, TCP_QUICKACK, SO_BUSY_POLL 50us)", true, 0);
+	run("low latency, spinning 100us", true, 100);
+}
@@ -0,0 +1,136 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "irc-client.h"
+
+/* Opens N idle sessions to a loopback listener in the same process and
+ * reports how much resident memory each one costs once connected. The
+ * listener only accepts; nothing is ever sent. */
+
+static std::atomic<int> connected { 0 };
+
+static void on_connect(cq_irc_session*)
+{
+	++connected;
+}
+
+static void on_disconnect(cq_irc_session*)
+{
+}
+
+static long resident_bytes()
+{
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (!statm)
+		return 0;
+
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+
+	fclose(statm);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char **argv)
+{
+	int sessions = argc > 1 ? atoi(argv[1]) : 10000;
+
+	/* Each session takes a descriptor on both ends. */
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	if (static_cast<rlim_t>(sessions) * 2 + 64 > limit.rlim_cur) {
+		sessions = (limit.rlim_cur - 64) / 2;
+		printf("Descriptor limit allows %d sessions.\n", sessions);
+	}
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address = {};
+	socklen_t address_size = sizeof(address);
+
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+	    listen(listener, 4096) != 0) {
+		perror("listen");
+		return 1;
+	}
+
+	getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size);
+
+	char port[8];
+	snprintf(port, sizeof(port), "%d", ntohs(address.sin_port));
+
+	std::vector<int> accepted;
+	std::thread acceptor([&]() {
+		for (int i = 0; i < sessions; ++i) {
+			int fd = accept(listener, nullptr, nullptr);
+
+			if (fd < 0)
+				break;
+
+			accepted.push_back(fd);
+		}
+	});
+
+	cq_irc_callbacks callbacks = {};
+	callbacks.signal_connect = on_connect;
+	callbacks.signal_disconnect = on_disconnect;
+
+	cq_irc_service *service = cq_irc_service_create();
+	std::vector<cq_irc_session*> list;
+
+	/* Warm up the allocator, the resolver and the reactor first, so the
+	 * baseline doesn't charge their one-off costs to the sessions. */
+	list.push_back(cq_irc_session_connect(service, "127.0.0.1", port, &callbacks));
+
+	while (connected.load() < 1)
+		cq_irc_service_poll(service);
+
+	long before = resident_bytes();
+
+	for (int i = 1; i < sessions; ++i) {
+		list.push_back(cq_irc_session_connect(service, "127.0.0.1", port, &callbacks));
+
+		/* Don't let the listen backlog overflow. */
+		if (i % 512 == 0) {
+			while (connected.load() < i - 1024)
+				cq_irc_service_poll(service);
+		}
+	}
+
+	while (connected.load() < sessions)
+		cq_irc_service_poll(service);
+
+	long after = resident_bytes();
+
+	printf("%d sessions: %.0f resident bytes per session\n",
+		sessions - 1, double(after - before) / (sessions - 1));
+
+	acceptor.join();
+
+	for (cq_irc_session *session : list) {
+		cq_irc_session_disconnect(session);
+		cq_irc_session_destroy(session);
+	}
+
+	for (int fd : accepted)
+		close(fd);
+
+	close(listener);
+	cq_irc_service_destroy(service);
+}
@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "irc-dispatch.h++"
+#include "irc-intern.h++"
+#include "irc-isupport.h++"
+#include "irc-state.h++"
+
+/* Feeds the state tracker the JOINs of a large network, straight into
+ * state_tracker::observe() with no session or socket, and reports how
+ * much resident memory the result costs and how long a membership check
+ * takes. Defaults: 2000 channels, 50000 users in four channels each,
+ * which must fit in under 20 MB; the bench fails if they don't. */
+
+static long resident_bytes()
+{
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (!statm)
+		return 0;
+
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+
+	fclose(statm);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void join(cq_irc::state_tracker &state, const std::string &our_nick,
+	const std::string &nick, const std::string &host, const std::string &channel)
+{
+	std::string name = channel;
+	cq_irc_message message;
+
+	memset(&message, 0, sizeof(message));
+	cq_irc::classify(&message, "JOIN", 4);
+	message.prefix.source = nick.c_str();
+	message.prefix.user = "~user";
+	message.prefix.host = host.c_str();
+	message.params.param[0] = &name[0];
+	message.params.length = 1;
+
+	state.observe(our_nick, &message, nullptr);
+}
+
+int main(int argc, char **argv)
+{
+	int channels = argc > 1 ? atoi(argv[1]) : 2000;
+	int users = argc > 2 ? atoi(argv[2]) : 50000;
+	const int per_user = 4;
+	const long limit = argc > 1 ? 0 : 20000000;
+	bool over = false;
+	const std::string us = "me";
+
+	cq_irc::isupport caps;
+	cq_irc::shared_intern_pool strings;
+	long before = resident_bytes();
+
+	{
+		cq_irc::state_tracker state(caps, strings);
+
+		for (int c = 0; c < channels; ++c)
+			join(state, us, us, "our.host", "#channel" + std::to_string(c));
+
+		for (int u = 0; u < users; ++u) {
+			std::string nick = "User" + std::to_string(u);
+			std::string host = "host-" + std::to_string(u) + ".example.net";
+
+			for (int i = 0; i < per_user; ++i)
+				join(state, us, nick, host, "#channel" + std::to_string((u * 7 + i * 13) % channels));
+		}
+
+		long after = resident_bytes();
+		long memberships = long(users) * per_user;
+
+		printf("%d channels, %d users, %ld memberships: %.1f MB resident, %.0f bytes per membership\n",
+			channels, users, memberships, (after - before) / 1e6, double(after - before) / memberships);
+
+		if (limit && after - before >= limit) {
+			printf("over the %.0f MB target\n", limit / 1e6);
+			over = true;
+		}
+
+		/* Asked in another case, so every lookup folds. */
+		std::vector<std::string> nicks, names;
+
+		for (int u = 0; u < users; ++u)
+			nicks.push_back("USER" + std::to_string(u));
+
+		for (int c = 0; c < channels; ++c)
+			names.push_back("#Channel" + std::to_string(c));
+
+		const int lookups = 1000000;
+		int found = 0;
+		auto start = std::chrono::steady_clock::now();
+
+		for (int i = 0; i < lookups; ++i) {
+			int u = i % users;
+			const std::string &channel = names[(u * 7 + (i % per_user) * 13) % channels];
+
+			found += state.is_member(channel.c_str(), nicks[u].c_str());
+		}
+
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+		printf("is_member: %.1f ns per lookup, %d of %d found\n", elapsed.count() / lookups, found, lookups);
+	}
+
+	return over ? 1 : 0;
+}
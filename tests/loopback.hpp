@@ -0,0 +1,109 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <cstdio>
+#include <istream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "irc-client.h"
+
+/* A server for one client on 127.0.0.1, for the tests that check what a
+ * session puts on the wire. It sends greeting once the client connects,
+ * records every line the client sends up to and including QUIT, then
+ * hangs up. */
+class loopback_server {
+public:
+	explicit loopback_server(const std::string &_greeting)
+		: acceptor(service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), 0)),
+		  greeting(_greeting)
+	{
+		snprintf(port_text, sizeof(port_text), "%d", acceptor.local_endpoint().port());
+		thread = std::thread(&loopback_server::serve, this);
+	}
+
+	const char *port() const
+	{
+		return port_text;
+	}
+
+	/* The lines received, CR LF stripped, once the client has quit. */
+	const std::vector<std::string> &join()
+	{
+		thread.join();
+
+		return lines;
+	}
+
+private:
+	boost::asio::io_service service;
+	boost::asio::ip::tcp::acceptor acceptor;
+	std::string greeting;
+	char port_text[8];
+	std::thread thread;
+	std::vector<std::string> lines;
+
+	void serve()
+	{
+		boost::asio::ip::tcp::socket socket(service);
+		boost::asio::streambuf input;
+		boost::system::error_code error;
+
+		acceptor.accept(socket);
+		boost::asio::write(socket, boost::asio::buffer(greeting));
+
+		while (boost::asio::read_until(socket, input, "\r\n", error)) {
+			std::istream stream(&input);
+			std::string line;
+
+			std::getline(stream, line);
+			line.erase(line.size() - 1);
+			lines.push_back(line);
+
+			if (line.compare(0, 4, "QUIT") == 0)
+				break;
+		}
+
+		socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+	}
+};
+
+/* Connects a session with callbacks to server and runs the service until
+ * the server hangs up. signal_connect may be left unset. */
+inline void run_session(loopback_server &server, cq_irc_callbacks callbacks)
+{
+	cq_irc_service *service = cq_irc_service_create();
+
+	if (!callbacks.signal_connect)
+		callbacks.signal_connect = [](cq_irc_session*) { };
+
+	callbacks.signal_disconnect = [](cq_irc_session *session) {
+		cq_irc_service_stop(cq_irc_session_get_service(session));
+	};
+
+	cq_irc_session *session = cq_irc_session_connect(service, "127.0.0.1", server.port(), &callbacks);
+
+	cq_irc_service_attach(service);
+
+	cq_irc_session_destroy(session);
+	cq_irc_service_destroy(service);
+}
+
+/* Prints what differs and returns 1 if the lines don't match. */
+inline int expect_lines(const std::vector<std::string> &got, const std::vector<std::string> &wanted)
+{
+	int failures = 0;
+
+	for (std::size_t i = 0; i < got.size() || i < wanted.size(); ++i) {
+		const char *a = i < got.size() ? got[i].c_str() : "(none)";
+		const char *b = i < wanted.size() ? wanted[i].c_str() : "(none)";
+
+		if (std::string(a) != b) {
+			printf("line %u: got \"%s\", wanted \"%s\"\n", unsigned(i), a, b);
+			failures = 1;
+		}
+	}
+
+	return failures;
+}
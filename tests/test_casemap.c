@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "irc-client.h"
+
+/* Checks cq_irc_casefold, cq_irc_casecmp and cq_irc_casehash, which
+ * fold 16 bytes at a time, against a byte-at-a-time reference on 20000
+ * random strings per CASEMAPPING. Lengths run past several blocks and
+ * bytes cover the whole range but NUL, so every fold boundary, the
+ * unfolded high half and the scalar tail all get exercised. */
+
+#define STRINGS 20000
+#define MAX_SIZE 80
+
+static char ref_fold_char(char c, enum cq_irc_casemapping casemapping)
+{
+	char high = casemapping == CQ_IRC_CASEMAPPING_ASCII ? 'Z' :
+		casemapping == CQ_IRC_CASEMAPPING_STRICT_RFC1459 ? ']' : '^';
+
+	return (c >= 'A' && c <= high) ? c + 0x20 : c;
+}
+
+static int ref_casecmp(enum cq_irc_casemapping casemapping, const char *a, const char *b)
+{
+	for (;; ++a, ++b) {
+		unsigned char x = ref_fold_char(*a, casemapping);
+		unsigned char y = ref_fold_char(*b, casemapping);
+
+		if (x != y)
+			return x < y ? -1 : 1;
+		if (!x)
+			return 0;
+	}
+}
+
+static uint32_t ref_casehash(enum cq_irc_casemapping casemapping, const char *str, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		hash ^= (unsigned char)ref_fold_char(str[i], casemapping);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+/* Mostly letters and the rfc1459 specials, which is where the mappings
+ * differ, with the occasional byte from anywhere else. */
+static char random_byte(void)
+{
+	static const char common[] = "AZaz[]\\^{}|~@`_-09Mm";
+
+	if (rand() % 4)
+		return common[rand() % (sizeof(common) - 1)];
+
+	return (char)(1 + rand() % 255);
+}
+
+static void random_string(char *out, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		out[i] = random_byte();
+
+	out[size] = '\0';
+}
+
+static int check(enum cq_irc_casemapping casemapping, const char *name)
+{
+	char a[MAX_SIZE + 1], b[MAX_SIZE + 1], folded[MAX_SIZE + 1];
+	int failures = 0;
+	int i;
+	size_t j;
+
+	for (i = 0; i < STRINGS; ++i) {
+		size_t size = rand() % (MAX_SIZE + 1);
+
+		random_string(a, size);
+
+		/* b is usually a with some bytes' case flipped, so that equal
+		 * and nearly equal pairs are common. */
+		memcpy(b, a, size + 1);
+
+		for (j = 0; j < size; ++j) {
+			if (rand() % 3 == 0 && ((b[j] >= 'A' && b[j] <= '^') || (b[j] >= 'a' && b[j] <= '~')))
+				b[j] ^= 0x20;
+		}
+
+		if (rand() % 4 == 0)
+			random_string(b, rand() % (MAX_SIZE + 1));
+
+		cq_irc_casefold(casemapping, a, size, folded);
+
+		for (j = 0; j < size; ++j) {
+			if (folded[j] != ref_fold_char(a[j], casemapping)) {
+				printf("%s: casefold differs at byte %u of a %u byte string\n", name, (unsigned)j, (unsigned)size);
+				++failures;
+				break;
+			}
+		}
+
+		if (sign(cq_irc_casecmp(casemapping, a, b)) != ref_casecmp(casemapping, a, b)) {
+			printf("%s: casecmp differs for a %u and a %u byte string\n", name, (unsigned)size, (unsigned)strlen(b));
+			++failures;
+		}
+
+		if (cq_irc_casehash(casemapping, a, size) != ref_casehash(casemapping, a, size)) {
+			printf("%s: casehash differs for a %u byte string\n", name, (unsigned)size);
+			++failures;
+		}
+
+		if (ref_casecmp(casemapping, a, b) == 0 &&
+		    cq_irc_casehash(casemapping, a, size) != cq_irc_casehash(casemapping, b, strlen(b))) {
+			printf("%s: equal strings hash differently\n", name);
+			++failures;
+		}
+
+		if (failures > 10)
+			break;
+	}
+
+	return failures;
+}
+
+int main(void)
+{
+	int failures = 0;
+
+	srand(1459);
+
+	failures += check(CQ_IRC_CASEMAPPING_ASCII, "ascii");
+	failures += check(CQ_IRC_CASEMAPPING_STRICT_RFC1459, "strict-rfc1459");
+	failures += check(CQ_IRC_CASEMAPPING_RFC1459, "rfc1459");
+
+	/* Spot checks of what each mapping folds. */
+	failures += cq_irc_casecmp(CQ_IRC_CASEMAPPING_ASCII, "Nick[]", "nick[]") != 0;
+	failures += cq_irc_casecmp(CQ_IRC_CASEMAPPING_ASCII, "Nick[]", "nick{}") == 0;
+	failures += cq_irc_casecmp(CQ_IRC_CASEMAPPING_STRICT_RFC1459, "Nick[]\\", "nick{}|") != 0;
+	failures += cq_irc_casecmp(CQ_IRC_CASEMAPPING_STRICT_RFC1459, "nick^", "nick~") == 0;
+	failures += cq_irc_casecmp(CQ_IRC_CASEMAPPING_RFC1459, "nick^", "NICK~") != 0;
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("casemap: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "loopback.hpp"
+
+/* Checks how cq_irc_session_privmsg_multi and cq_irc_session_notice_multi
+ * pack targets. The server advertises TARGMAX=PRIVMSG:3,NOTICE:2 and
+ * tells the session its 22 byte prefix (":me!user@example.host "), so
+ * the packing must follow the per-command limits, stop adding targets
+ * once the line would pass 510 bytes with the prefix, fall back to
+ * splitting for a target that can't share a line with the message, and
+ * queue nothing at all for a call that fails. */
+
+static int failures = 0;
+
+static const std::string long_text(475, 'm');
+static const std::string long_channel = "#a-channel-name-too-long-to-fit";
+static const std::string huge_channel = "#" + std::string(489, 'h');
+
+static void expect(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("failed: %s\n", what);
+		++failures;
+	}
+}
+
+/* Our JOIN echo arrives after 001 (and 005), so by now the session knows
+ * its prefix and the server's limits. */
+static void on_unknown(cq_irc_session *session, const char *command, cq_irc_message*)
+{
+	if (strcmp(command, "JOIN") != 0)
+		return;
+
+	const char *targets[] = { "#a", "#b", "#c", "#d", "#e", "#f", "#g" };
+	const char *comma[] = { "#a", "#b,#c" };
+	const char *spaced[] = { "#a", "#b #c" };
+	const char *oversized[] = { "#a", long_channel.c_str(), "#b" };
+	const char *unsendable[] = { "#a", huge_channel.c_str() };
+
+	expect(cq_irc_session_privmsg_multi(session, targets, 7, "hi") == 0, "privmsg to seven targets");
+	expect(cq_irc_session_notice_multi(session, targets, 5, "yo") == 0, "notice to five targets");
+
+	/* 22 + "PRIVMSG " + "#a,#b" + " :" + 475 is 512: one target a line. */
+	expect(cq_irc_session_privmsg_multi(session, targets, 2, long_text.c_str()) == 0, "long privmsg to two targets");
+
+	/* The long channel leaves no room for the text and is split alone,
+	 * after the lines that could be packed. */
+	expect(cq_irc_session_privmsg_multi(session, oversized, 3, long_text.c_str()) == 0, "privmsg with an oversized target");
+
+	/* No room for even one byte of text next to the huge channel: the
+	 * call fails, and the line for #a must not go out either. */
+	expect(cq_irc_session_privmsg_multi(session, unsendable, 2, "x") == -1, "target with no room for text");
+
+	expect(cq_irc_session_privmsg_multi(session, comma, 2, "x") == -1, "comma in a target");
+	expect(cq_irc_session_privmsg_multi(session, spaced, 2, "x") == -1, "space in a target");
+	expect(cq_irc_session_privmsg_multi(session, targets, 2, "x\r\nQUIT") == -1, "CR LF in the text");
+	expect(cq_irc_session_privmsg_multi(session, targets, 0, "x") == 0, "no targets");
+
+	cq_irc_session_quit(session, nullptr);
+}
+
+int main()
+{
+	loopback_server server(
+		":srv 001 me :hi\r\n"
+		":srv 005 me TARGMAX=PRIVMSG:3,NOTICE:2 :are supported by this server\r\n"
+		":me!user@example.host JOIN #c\r\n");
+	cq_irc_callbacks callbacks = {};
+
+	callbacks.signal_unknown = on_unknown;
+	run_session(server, callbacks);
+
+	/* The oversized target's budget is 510 - 22 - "PRIVMSG <channel> :". */
+	std::size_t budget = 510 - 22 - (8 + long_channel.size() + 2);
+
+	failures += expect_lines(server.join(), {
+		"PRIVMSG #a,#b,#c :hi",
+		"PRIVMSG #d,#e,#f :hi",
+		"PRIVMSG #g :hi",
+		"NOTICE #a,#b :yo",
+		"NOTICE #c,#d :yo",
+		"NOTICE #e :yo",
+		"PRIVMSG #a :" + long_text,
+		"PRIVMSG #b :" + long_text,
+		"PRIVMSG #a :" + long_text,
+		"PRIVMSG #b :" + long_text,
+		"PRIVMSG " + long_channel + " :" + long_text.substr(0, budget),
+		"PRIVMSG " + long_channel + " :" + long_text.substr(budget),
+		"QUIT"
+	});
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("fanout: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "irc-scan.h++"
+#include "loopback.hpp"
+
+/* Checks that the outbound functions refuse anything that would let a
+ * caller smuggle a second command onto the wire (CR, LF, NUL) or break
+ * the line's framing (bad middle parameters), that a refused call
+ * queues nothing, and that accepted lines go out intact and in order. */
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("failed: %s\n", what);
+		++failures;
+	}
+}
+
+static void on_connect(cq_irc_session *session)
+{
+	const char *channel[] = { "#c" };
+	const char *injected_param[] = { "#c\r\nQUIT" };
+	const char *empty_param[] = { "" };
+	const char *colon_param[] = { ":#c" };
+	const char *spaced_param[] = { "#c #d" };
+	const char *comma_target[] = { "#a", "#b,#c" };
+	const char *mode[] = { "#c", "+o", "me" };
+
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, 1, "a\r\nQUIT :x") == -1, "CR LF in trailing");
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, 1, "a\nb") == -1, "LF in trailing");
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, 1, "a\rb") == -1, "CR in trailing");
+	expect(cq_irc_session_send(session, "PRIVMSG", injected_param, 1, "x") == -1, "CR LF in a parameter");
+	expect(cq_irc_session_send(session, "PRIVMSG", empty_param, 1, "x") == -1, "empty parameter");
+	expect(cq_irc_session_send(session, "PRIVMSG", colon_param, 1, "x") == -1, "parameter starting with ':'");
+	expect(cq_irc_session_send(session, "PRIVMSG", spaced_param, 1, "x") == -1, "space in a parameter");
+	expect(cq_irc_session_send(session, "PRIVMSG\r\nQUIT", channel, 1, "x") == -1, "CR LF in the command");
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, -1, "x") == -1, "negative parameter count");
+	expect(cq_irc_session_privmsg(session, "#c", "hi\r\nQUIT :x") == -1, "CR LF in privmsg text");
+	expect(cq_irc_session_privmsg(session, "#c x", "hi") == -1, "space in privmsg target");
+	expect(cq_irc_session_notice(session, "#c", "hi\nQUIT") == -1, "LF in notice text");
+	expect(cq_irc_session_privmsg_multi(session, comma_target, 2, "hi") == -1, "comma in a fan-out target");
+	expect(cq_irc_session_pong(session, "x\r\nQUIT") == -1, "CR LF in pong token");
+	expect(cq_irc_session_quit(session, "bye\r\nPRIVMSG #c :x") == -1, "CR LF in quit message");
+
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, 1, "ok one") == 0, "plain send");
+	expect(cq_irc_session_send(session, "MODE", mode, 3, nullptr) == 0, "send without trailing");
+	expect(cq_irc_session_send(session, "PRIVMSG", channel, 1, ":colons and spaces: fine") == 0, "trailing with ':'");
+	expect(cq_irc_session_privmsg(session, "#c", "ok two") == 0, "plain privmsg");
+	expect(cq_irc_session_quit(session, "bye") == 0, "quit");
+}
+
+/* The kernels behind the checks, for NUL, which no C string argument
+ * can carry: every break character at every offset, across the 16 byte
+ * blocks and the scalar tail. */
+static void check_scan()
+{
+	static const char breaks[] = { '\r', '\n', '\0', ' ' };
+	char data[64];
+
+	for (std::size_t size = 1; size <= sizeof(data); ++size) {
+		for (std::size_t at = 0; at < size; ++at) {
+			for (char c : breaks) {
+				memset(data, 'x', size);
+				data[at] = c;
+
+				const char *line_end = cq_irc::find_line_break(data, size);
+				const char *param_end = cq_irc::find_param_break(data, size);
+
+				expect(param_end == data + at, "find_param_break finds the break");
+				expect(line_end == (c == ' ' ? data + size : data + at), "find_line_break finds the break");
+			}
+		}
+
+		memset(data, 'x', size);
+		expect(cq_irc::find_line_break(data, size) == data + size, "find_line_break on clean data");
+		expect(cq_irc::find_param_break(data, size) == data + size, "find_param_break on clean data");
+	}
+}
+
+int main()
+{
+	loopback_server server(":srv 001 me :hi\r\n");
+	cq_irc_callbacks callbacks = {};
+
+	check_scan();
+
+	callbacks.signal_connect = on_connect;
+	run_session(server, callbacks);
+
+	failures += expect_lines(server.join(), {
+		"PRIVMSG #c :ok one",
+		"MODE #c +o me",
+		"PRIVMSG #c ::colons and spaces: fine",
+		"PRIVMSG #c :ok two",
+		"QUIT :bye"
+	});
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("send: ok\n");
+
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "loopback.hpp"
+
+/* Checks how cq_irc_session_privmsg and cq_irc_session_notice split long
+ * text. The server tells the session its prefix (me!user@example.host,
+ * 22 bytes as ":me!user@example.host ") before anything is sent, so
+ * every line must fit in 510 bytes with it. Word splits must fall after
+ * the last space that fits, words too long for a line must be cut on a
+ * UTF-8 code point boundary, and the parts put back together must give
+ * the original text. */
+
+static const std::size_t prefix_size = 22;
+static const std::size_t line_limit = 510;
+
+static int failures = 0;
+
+static std::string words_text()
+{
+	std::string text;
+
+	for (int i = 0; text.size() < 1500; ++i) {
+		if (!text.empty())
+			text += ' ';
+
+		text += std::string(1 + (i * 7) % 13, 'a' + i % 26);
+	}
+
+	return text;
+}
+
+/* Two, three and four byte sequences and no spaces at all. */
+static std::string utf8_text()
+{
+	std::string text;
+
+	while (text.size() < 1200)
+		text += "\xc3\xa9" "\xe2\x82\xac" "\xf0\x9f\x98\x80" "x";
+
+	return text;
+}
+
+/* A word longer than a line between short ones. */
+static std::string long_word_text()
+{
+	return "short " + std::string(700, 'w') + " tail";
+}
+
+struct sent {
+	const char *command;
+	std::string text;
+};
+
+static std::vector<sent> sends;
+
+/* Our JOIN echo arrives after 001 (and 005), so by now the session knows
+ * its prefix and the server's limits. */
+static void on_unknown(cq_irc_session *session, const char *command, cq_irc_message*)
+{
+	if (strcmp(command, "JOIN") != 0)
+		return;
+
+	sends = {
+		{ "PRIVMSG", "fits in one line" },
+		{ "PRIVMSG", words_text() },
+		{ "NOTICE", words_text() },
+		{ "PRIVMSG", utf8_text() },
+		{ "PRIVMSG", long_word_text() }
+	};
+
+	for (const sent &s : sends) {
+		int result = std::string(s.command) == "NOTICE" ?
+			cq_irc_session_notice(session, "#c", s.text.c_str()) :
+			cq_irc_session_privmsg(session, "#c", s.text.c_str());
+
+		if (result != 0) {
+			printf("failed: %s was rejected\n", s.command);
+			++failures;
+		}
+	}
+
+	cq_irc_session_quit(session, nullptr);
+}
+
+static bool is_continuation(char c)
+{
+	return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+/* Checks the parts one send was split into and returns how many lines
+ * they took. Walking the text part by part, the only byte allowed
+ * between two parts is the space a word split dropped. */
+static std::size_t check_send(const sent &s, const std::vector<std::string> &lines, std::size_t first)
+{
+	std::string framing = std::string(s.command) + " #c :";
+	std::size_t budget = line_limit - prefix_size - framing.size();
+	bool spaced = s.text.find(' ') != std::string::npos;
+	std::size_t pos = 0;
+	std::size_t i = first;
+
+	for (; i < lines.size() && pos < s.text.size(); ++i) {
+		if (lines[i].compare(0, framing.size(), framing) != 0) {
+			printf("failed: \"%s\" is not a %s to #c\n", lines[i].c_str(), s.command);
+			++failures;
+			break;
+		}
+
+		if (lines[i].size() + prefix_size > line_limit) {
+			printf("failed: a %u byte %s line is over the limit\n", unsigned(lines[i].size()), s.command);
+			++failures;
+		}
+
+		std::string part = lines[i].substr(framing.size());
+
+		if (part.empty() || is_continuation(part[0]) || s.text.compare(pos, part.size(), part) != 0) {
+			printf("failed: part %u of a %s doesn't continue its text\n", unsigned(i - first), s.command);
+			++failures;
+			break;
+		}
+
+		pos += part.size();
+
+		if (pos == s.text.size())
+			break;
+
+		if (s.text[pos] == ' ') {
+			/* A word split: the next word must not have fitted. */
+			std::size_t next_word = s.text.find(' ', pos + 1);
+
+			if (next_word == std::string::npos)
+				next_word = s.text.size();
+
+			if (part.size() + (next_word - pos) <= budget) {
+				printf("failed: part %u of a %s split early\n", unsigned(i - first), s.command);
+				++failures;
+			}
+
+			++pos;
+		} else if (spaced && part.find(' ') != std::string::npos) {
+			printf("failed: part %u of a %s cut a word with a space in range\n", unsigned(i - first), s.command);
+			++failures;
+		} else if (part.size() + 4 <= budget) {
+			/* A cut inside a word only backs off to the code point start. */
+			printf("failed: part %u of a %s cut short at %u bytes\n", unsigned(i - first), s.command, unsigned(part.size()));
+			++failures;
+		}
+	}
+
+	if (pos != s.text.size()) {
+		printf("failed: a %s's parts don't add up to its text\n", s.command);
+		++failures;
+	}
+
+	return i - first + 1;
+}
+
+int main()
+{
+	loopback_server server(
+		":srv 001 me :hi\r\n"
+		":me!user@example.host JOIN #c\r\n");
+	cq_irc_callbacks callbacks = {};
+
+	callbacks.signal_unknown = on_unknown;
+	run_session(server, callbacks);
+
+	const std::vector<std::string> &lines = server.join();
+	std::size_t next = 0;
+
+	for (const sent &s : sends)
+		next += check_send(s, lines, next);
+
+	if (lines.size() != next + 1 || lines.empty() || lines.back() != "QUIT") {
+		printf("failed: %u lines for %u parts and a QUIT\n", unsigned(lines.size()), unsigned(next));
+		++failures;
+	}
+
+	/* One line, and at least three for everything longer than 1000. */
+	if (next < 1 + 3 + 3 + 3 + 2) {
+		printf("failed: only %u lines\n", unsigned(next));
+		++failures;
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("split: ok\n");
+
+	return 0;
+}